@@ -1,4 +1,4 @@
-gcc ./examples/sparse_matrix_multiply.c -o ./build/sparse_matrix_multiply -I. -Lbuild -lswarm -lvulkan -lm
+gcc ./examples/sparse_matrix_multiply.c -o ./build/sparse_matrix_multiply -I. -Lbuild -lswarm -lvulkan -lm -lpthread
 export VK_INSTANCE_LAYERS=VK_LAYER_KHRONOS_validation
 export VK_LOADER_DEBUG=warn
 ./build/sparse_matrix_multiply
\ No newline at end of file
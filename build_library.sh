@@ -10,11 +10,15 @@ CFLAGS="-g -O0 -Wall -fPIC"          # -g  → debug info
 INC="-Isrc -I/usr/include/vulkan"
 
 # ---- compile ----------------------------------------------------------------
-for f in vk_setup vk_buffer vk_command vk_program; do
+for f in vk_setup vk_buffer vk_command vk_program vk_profile vk_memory vk_cache vk_tune; do
     echo "Compiling $f.c (debug)..."
     gcc -c $CFLAGS $INC -o build/$f.o src/$f.c
 done
 
+echo "Compiling embedded shaders (debug)..."
+./embed_shaders.sh build/swarm_shaders.c
+gcc -c $CFLAGS $INC -o build/swarm_shaders.o build/swarm_shaders.c
+
 echo "Compiling spirv_reflect.c (debug)..."
 gcc -c $CFLAGS $INC -o build/spirv_reflect.o src/include/spirv_reflect.c
 
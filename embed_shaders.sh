@@ -0,0 +1,40 @@
+#!/bin/bash
+
+set -e
+
+# Generates a C table of every shaders/compiled/*.spv, compiled into libswarm.a by build_library.sh.
+# Programs can then be made with createEmbeddedProgram without the shader files on disk.
+
+OUTPUT="${1:-build/swarm_shaders.c}"
+mkdir -p "$(dirname "$OUTPUT")"
+
+echo "Embedding SPIR-V shaders into $OUTPUT..."
+
+names=()
+{
+    echo "// Generated by embed_shaders.sh, do not edit."
+    echo "#include \"vk_program.h\""
+    echo ""
+
+    for spv in shaders/compiled/*.spv; do
+        [ -f "$spv" ] || continue
+        name=$(basename "$spv" .spv)
+        ident=$(echo "$name" | tr -c 'A-Za-z0-9_\n' '_')
+        names+=("$name:$ident")
+        echo "static const uint32_t shader_${ident}[] = {"
+        # SPIR-V is a stream of 32-bit words in host order, od prints them as such.
+        od -An -v -tx4 "$spv" | sed -e 's/ *\([0-9a-f]\{8\}\)/ 0x\1,/g'
+        echo "};"
+        echo ""
+    done
+
+    echo "const VKEMBEDDEDSHADER swarm_embedded_shaders[] = {"
+    for entry in "${names[@]}"; do
+        echo "    { \"${entry%%:*}\", shader_${entry##*:}, sizeof(shader_${entry##*:}) },"
+    done
+    [ ${#names[@]} -gt 0 ] || echo "    { 0 }"
+    echo "};"
+    echo "const uint32_t swarm_embedded_shader_count = ${#names[@]};"
+} > "$OUTPUT"
+
+echo "Embedded ${#names[@]} shader(s)"
@@ -9,38 +9,28 @@ int main(){
 
     printf("Create programs...\n");
     VKPROGRAM programs[2] = {0};
-    programs[0] = createProgram(ctx, spirv_path);
-    printf("A\n");
-    printf("%s\n", spirv_path);
-    programs[1] = createProgram(ctx, spirv_path);
-    printf("A\n");
+    const char* paths[2] = { spirv_path, spirv_path };
+    createPrograms(ctx, paths, 2, programs);
 
     printf("Create buffers...\n");
-    VKBUFFER cpu_buffer = newBuffer(ctx, buff_size, BUF_CPU);
     VKBUFFER bufA       = newBuffer(ctx, buff_size, BUF_GPU);
     VKBUFFER bufB       = newBuffer(ctx, buff_size, BUF_GPU);
     VKBUFFER output     = newBuffer(ctx, buff_size, BUF_GPU);
     VKBUFFER indirect   = newBuffer(ctx, 3 * sizeof(uint32_t), BUF_INDIRECT);
     
-    printf("Map buffer & copy data...\n");
-    float* mapped = mapBuffer(ctx, cpu_buffer);
+    printf("Upload to GPU buffers...\n");
+    float* data = malloc(buff_size);
     for(int i = 0; i < element_count; i++){
-        mapped[i] = (float) i;
+        data[i] = (float) i;
     }
-    unmapBuffer(ctx, cpu_buffer);
+    swarmUpload(ctx, bufA, 0, data, buff_size);
+    swarmUpload(ctx, bufB, 0, data, buff_size);
 
-    printf("Copy to GPU buffers...\n");
-    runCopyCommand(ctx, cpu_buffer, bufA, 0, 0, cpu_buffer.size);
-    runCopyCommand(ctx, cpu_buffer, bufB, 0, 0, cpu_buffer.size);
-    
-    //map buffer again and copy indirect value to gpu
-    uint32_t* m = mapBuffer(ctx, cpu_buffer);
-    uint32_t groups = (element_count + 63) / 64;
-    m[0] = groups;
-    m[1] = 1;
-    m[2] = 1;
-    unmapBuffer(ctx, cpu_buffer);
-    runCopyCommand(ctx, cpu_buffer, indirect, 0, 0, indirect.size);
+    //indirect dispatch arguments
+    uint32_t local = programs[0].local_size[0]; //WORKGROUP_SIZE, 64 unless specialized.
+    uint32_t groups = (element_count + local - 1) / local;
+    uint32_t args[3] = { groups, 1, 1 };
+    swarmUpload(ctx, indirect, 0, args, sizeof(args));
 
     printf("Bind buffers to program...\n");
     VKBUFFER buffers[3];
@@ -62,22 +52,18 @@ int main(){
     printf("run compute command...\n");
     runComputeCommand(ctx, programs, 2, indirect);
 
-    printf("Copy data back to cpu buffer...\n");
-    runCopyCommand(ctx, output, cpu_buffer, 0, 0, output.size);
-    
-    printf("Map buffer & print results...\n");
-    mapped = mapBuffer(ctx, cpu_buffer);
+    printf("Download & print results...\n");
+    swarmDownload(ctx, data, output, 0, buff_size);
     for(int i = 0; i < element_count; i++){
-        printf("%d ", (int) mapped[i]);
+        printf("%d ", (int) data[i]);
     }
     printf("\n");
-    unmapBuffer(ctx, cpu_buffer);
+    free(data);
 
     printf("Destroy buffers, program and context...\n");
     destroyBuffer(ctx, bufA);
     destroyBuffer(ctx, bufB);
     destroyBuffer(ctx, output);
-    destroyBuffer(ctx, cpu_buffer);
     destroyBuffer(ctx, indirect);
     destroyProgram(ctx, spirv_path);
     destroyVkContext(ctx);
@@ -53,50 +53,18 @@ int main(){
     VKBUFFER buf_weights  = newBuffer(ctx, wSz,   BUF_GPU);
     VKBUFFER buf_indirect = newBuffer(ctx, 3 * sizeof(uint32_t), BUF_INDIRECT);
 
-    /* ---- CPU staging / read-back ---------------------------------------- */
-    VKBUFFER cpu_stage    = newBuffer(ctx, 128, BUF_CPU);
-
     /* ---- upload host data to GPU -----------------------------------------
-       Exactly the same pattern used in add.c: map, memcpy, unmap, copy.     */
-    /* inputs */
-    float* p = mapBuffer(ctx, cpu_stage);
-    memcpy(p, h_inputs, inSz);
-    unmapBuffer(ctx, cpu_stage);
-    runCopyCommand(ctx, cpu_stage, buf_inputs, 0, 0, inSz);
-
-    /* update indices */
-    p = mapBuffer(ctx, cpu_stage);
-    memcpy(p, h_update, upSz);
-    unmapBuffer(ctx, cpu_stage);
-    runCopyCommand(ctx, cpu_stage, buf_update, 0, 0, upSz);
-
-    /* start_positions */
-    p = mapBuffer(ctx, cpu_stage);
-    memcpy(p, h_start, stSz);
-    unmapBuffer(ctx, cpu_stage);
-    runCopyCommand(ctx, cpu_stage, buf_start, 0, 0, stSz);
-
-    /* to_indices */
-    p = mapBuffer(ctx, cpu_stage);
-    memcpy(p, h_toIdx, idxSz);
-    unmapBuffer(ctx, cpu_stage);
-    runCopyCommand(ctx, cpu_stage, buf_toIdx, 0, 0, idxSz);
-
-    /* weights */
-    p = mapBuffer(ctx, cpu_stage);
-    memcpy(p, h_weights, wSz);
-    unmapBuffer(ctx, cpu_stage);
-    runCopyCommand(ctx, cpu_stage, buf_weights, 0, 0, wSz);
-
-    uint32_t groups = (N_ROWS + 63) / 64;
-    uint32_t* ip = mapBuffer(ctx, cpu_stage);
-    ip[0] = groups;
-    ip[1] = 1;
-    ip[2] = 1;
-    unmapBuffer(ctx, cpu_stage);
-    runCopyCommand(ctx, cpu_stage, buf_indirect, 0, 0, buf_indirect.size);
-
-
+       Every array goes through the context's staging ring, the copies are
+       submitted together ahead of the dispatch.                             */
+    uint32_t groups = (N_ROWS + prog.local_size[0] - 1) / prog.local_size[0];
+    uint32_t h_indirect[3] = {groups, 1, 1};
+
+    swarmUpload(ctx, buf_inputs,   0, h_inputs,   inSz);
+    swarmUpload(ctx, buf_update,   0, h_update,   upSz);
+    swarmUpload(ctx, buf_start,    0, h_start,    stSz);
+    swarmUpload(ctx, buf_toIdx,    0, h_toIdx,    idxSz);
+    swarmUpload(ctx, buf_weights,  0, h_weights,  wSz);
+    swarmUpload(ctx, buf_indirect, 0, h_indirect, sizeof(h_indirect));
 
     /* ---- bind to descriptor set ----------------------------------------- */
     VKBUFFER bufs[] = { buf_inputs, buf_outputs, buf_update,
@@ -111,14 +79,12 @@ int main(){
     runComputeCommand(ctx, &prog, 1, buf_indirect);
 
     /* ---- read back ------------------------------------------------------- */
-    runCopyCommand(ctx, buf_outputs, cpu_stage, 0, 0, outSz);
+    swarmDownload(ctx, h_outputs, buf_outputs, 0, outSz);
 
     /* ---- print ----------------------------------------------------------- */
-    p = mapBuffer(ctx, cpu_stage);
     printf("y = A·x  -->  ");
-    for(uint32_t i=0;i<N_ROWS;++i) printf("%.1f ", p[i]);
+    for(uint32_t i=0;i<N_ROWS;++i) printf("%.1f ", h_outputs[i]);
     printf("\n");
-    unmapBuffer(ctx, cpu_stage);
 
     /* ---- clean-up -------------------------------------------------------- */
     destroyBuffer(ctx, buf_inputs);
@@ -128,7 +94,6 @@ int main(){
     destroyBuffer(ctx, buf_toIdx);
     destroyBuffer(ctx, buf_weights);
     destroyBuffer(ctx, buf_indirect);
-    destroyBuffer(ctx, cpu_stage);
     destroyProgram(ctx, spirv_path);
     destroyVkContext(ctx);
     printf("Fin.\n");
@@ -1,67 +1,158 @@
 #include "vk_buffer.h"
+#include "vk_memory.h"
+#include "vk_command.h"
 
 VKBUFFER newBuffer(VKCTX ctx, VkDeviceSize size, BufferLocation where){
-    VkBufferUsageFlags usage;
-    if(where == BUF_INDIRECT){
-        usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    } else {
-        usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
-                            | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                            | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-                            | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    const VkMemoryPropertyFlags visible  = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    const VkMemoryPropertyFlags coherent = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    const VkMemoryPropertyFlags cached   = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    uint32_t type;
+    switch (where) {
+    case BUF_CPU:
+        type = findMemoryType(ctx, visible | coherent, 0, 0);
+        break;
+    case BUF_READBACK: //CPU reads from uncached memory are very slow, non-coherent is fine when invalidated.
+        type = findMemoryType(ctx, visible, cached, 0);
+        break;
+    case BUF_UPLOAD:   //Uncached means write-combined, fast for streaming writes the CPU never reads back.
+        type = findMemoryType(ctx, visible, 0, cached);
+        break;
+    case BUF_SHARED:   //Without shared memory it is plain device memory, swarmUpload/Download stage it.
+        if (ctx.allocator->shared_type != UINT32_MAX) {
+            type = ctx.allocator->shared_type;
+            break;
+        }
+        //fallthrough
+    default:
+        type = findMemoryType(ctx, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, 0);
+        break;
     }
 
-    VkBufferCreateInfo bufInfo = {
-        .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size        = size,
-        .usage       = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
-
+    //Carved out of a shared block, whose buffer is concurrent between the compute and transfer families.
     VKBUFFER buf = {0};
     buf.size = size;
     buf.location = where;
-    VK_CHECK(vkCreateBuffer(ctx.device, &bufInfo, NULL, &buf.buffer));
-
-    VkMemoryRequirements req;
-    vkGetBufferMemoryRequirements(ctx.device, buf.buffer, &req);
+    buf.block = allocateMemory(ctx, type, size, &buf.offset);
+    if (!buf.block) {
+        fprintf(stderr, "newBuffer: %llu bytes do not fit the memory budget\n", (unsigned long long)size);
+        return (VKBUFFER){0}; //buffer is VK_NULL_HANDLE, callers can shrink and retry.
+    }
+    buf.buffer = buf.block->buffer;
+    buf.memory = buf.block->memory;
+    buf.memory_flags = ctx.allocator->props.memoryTypes[type].propertyFlags;
+    if (buf.block->mapped) buf.mapped = (char*)buf.block->mapped + buf.offset;
+    return buf;
+}
 
-    VkPhysicalDeviceMemoryProperties props;
-    vkGetPhysicalDeviceMemoryProperties(ctx.physical_device, &props);
+VKBUFFER newBufferFromHostPointer(VKCTX ctx, void* ptr, VkDeviceSize size){
+    VKBUFFER buf = {0};
+    buf.block = importHostMemory(ctx, ptr, size);
+    if (!buf.block) {
+        fprintf(stderr, "newBufferFromHostPointer: cannot import %p, VK_EXT_external_memory_host missing or pointer misaligned (needs %llu)\n",
+                ptr, (unsigned long long)ctx.allocator->import_alignment);
+        return (VKBUFFER){0};
+    }
+    buf.buffer = buf.block->buffer;
+    buf.memory = buf.block->memory;
+    buf.size = size;
+    buf.location = BUF_CPU;
+    buf.mapped = ptr;
+    buf.memory_flags = ctx.allocator->props.memoryTypes[buf.block->memory_type].propertyFlags;
+    return buf;
+}
 
-    VkMemoryPropertyFlags wanted = (where == BUF_CPU)
-                                 ? (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
-                                 : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+bool swarmHasSharedMemory(VKCTX ctx){
+    return ctx.allocator->shared_type != UINT32_MAX;
+}
 
-    uint32_t index = 0;
-    for (; index < props.memoryTypeCount; ++index)
-        if ((req.memoryTypeBits & (1u << index)) &&
-            (props.memoryTypes[index].propertyFlags & wanted) == wanted)
-            break;
+VKBUFFER newGrowableBuffer(VKCTX ctx, VkDeviceSize size, BufferLocation where){
+    VKBUFFER storage = newBuffer(ctx, size, where);
+    if (storage.buffer == VK_NULL_HANDLE) return storage;
+    VKGROWABLE* g = XMALLOC(sizeof(VKGROWABLE));
+    g->storage = storage;
+    g->size = size;
+    g->generation = 0;
+    storage.growable = g;
+    return currentBuffer(storage);
+}
 
-    if (index == props.memoryTypeCount) {
-        fprintf(stderr, "no suitable memory type\n");
+bool growBuffer(VKCTX ctx, VKBUFFER* buf, VkDeviceSize size){
+    VKGROWABLE* g = buf->growable;
+    if (!g) {
+        fprintf(stderr, "growBuffer: buffer was not made by newGrowableBuffer\n");
         exit(1);
     }
+    VKBUFFER old = g->storage;
+    if (size > old.size) {
+        VkDeviceSize capacity = old.size * 2 > size ? old.size * 2 : size;
+        VKBUFFER storage = newBuffer(ctx, capacity, old.location);
+        if (storage.buffer == VK_NULL_HANDLE) return false;
+        //Queued behind every submission that still writes the old storage. Host writes through
+        //the new mapping would race the copy, so mapped storage waits for it.
+        if (g->size) {
+            VKTICKET copied = runCopyCommandAsync(ctx, old, storage, 0, 0, g->size);
+            if (storage.mapped) swarmWait(ctx, copied);
+        }
+        g->storage = storage;
+    }
 
-    VkMemoryAllocateFlagsInfo flags = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-    };
+    //Sets covering the old size are stale even when the storage stays, programs rebind on dispatch.
+    uint32_t set_count;
+    VKDESCRIPTORSET* sets = forgetDescriptorSets((BufferRange){ old.buffer, old.offset, old.size }, &set_count);
+    if (g->storage.buffer != old.buffer || g->storage.offset != old.offset)
+        retireMemory(ctx, old.block, old.offset, old.size, sets, set_count);
+    else
+        retireMemory(ctx, NULL, 0, 0, sets, set_count);
+    g->size = size;
+    g->generation++;
+    *buf = currentBuffer(*buf);
+    return true;
+}
 
-    VkMemoryAllocateInfo alloc = {
-        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .pNext           = &flags,
-        .allocationSize  = req.size,
-        .memoryTypeIndex = index,
-    };
+VKBUFFER bufferView(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize range){
+    buf = currentBuffer(buf);
+    if (offset + range > buf.size) {
+        fprintf(stderr, "bufferView: [%llu, %llu) is outside a buffer of %llu bytes\n",
+                (unsigned long long)offset, (unsigned long long)(offset + range), (unsigned long long)buf.size);
+        exit(1);
+    }
+    VkDeviceSize align = ctx.allocator->storage_alignment;
+    if ((buf.offset + offset) % align) {
+        fprintf(stderr, "bufferView: offset %llu is not a multiple of minStorageBufferOffsetAlignment (%llu)\n",
+                (unsigned long long)offset, (unsigned long long)align);
+        exit(1);
+    }
+    VKBUFFER view = buf;
+    view.offset += offset;
+    view.size = range;
+    if (view.mapped) view.mapped = (char*)view.mapped + offset;
+    view.view = true;
+    view.view_offset += offset; //currentBuffer finds the window again after a growBuffer.
+    return view;
+}
 
-    VK_CHECK(vkAllocateMemory(ctx.device, &alloc, NULL, &buf.memory));
-    VK_CHECK(vkBindBufferMemory(ctx.device, buf.buffer, buf.memory, 0));
-    return buf;
+//Make host writes to [offset, offset + size) visible to the device, and device writes visible to the
+//host. Only needed on non-coherent memory, both widen the range to nonCoherentAtomSize.
+void swarmFlush(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize size){
+    if (buf.mapped && size) flushMemory(ctx, buf.block, buf.offset + offset, size);
+}
+
+void swarmInvalidate(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize size){
+    if (buf.mapped && size) invalidateMemory(ctx, buf.block, buf.offset + offset, size);
 }
 
 void destroyBuffer(VKCTX ctx, VKBUFFER buf){
-    vkDestroyBuffer(ctx.device, buf.buffer, NULL);
-    vkFreeMemory(ctx.device, buf.memory, NULL);
-}
\ No newline at end of file
+    if (buf.view) return;
+    if (buf.growable) {
+        VKGROWABLE* g = buf.growable;
+        destroyBuffer(ctx, g->storage);
+        free(g);
+        return;
+    }
+    if (!buf.block) return;
+    //Async submissions may still use it, the range and any sets cached on it are only reused once they have finished.
+    uint32_t set_count;
+    VKDESCRIPTORSET* sets = forgetDescriptorSets((BufferRange){ buf.buffer, buf.offset, buf.size }, &set_count);
+    retireMemory(ctx, buf.block, buf.offset, buf.size, sets, set_count);
+    releaseRetired(ctx);
+}
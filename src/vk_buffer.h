@@ -10,24 +10,84 @@
 typedef enum {
     BUF_CPU = 0,
     BUF_GPU = 1,
-    BUF_INDIRECT = 2
+    BUF_INDIRECT = 2,
+    BUF_SHARED = 3, //Device-local and host-visible when the device has such memory, see swarmHasSharedMemory.
+    BUF_READBACK = 4, //Host-cached if possible, for data the CPU reads. May be non-coherent.
+    BUF_UPLOAD = 5 //Write-combined if possible, for data the CPU only writes. May be non-coherent.
 } BufferLocation;
 
+typedef struct VKGROWABLE VKGROWABLE;
+
 typedef struct VKBUFFER {
     VkBuffer       buffer;
     VkDeviceMemory memory;
     VkDeviceSize   size;
     BufferLocation location;
+    VkDeviceSize   offset; //Start of this buffer inside `buffer` and `memory`.
+    VKBLOCK*       block;
+    void*          mapped; //Host pointer for host-visible buffers, NULL otherwise.
+    VkMemoryPropertyFlags memory_flags;
+    bool           view; //Made by bufferView, shares the memory of another buffer.
+    VkDeviceSize   view_offset; //Start of a view inside the buffer it was made from.
+    VKGROWABLE*    growable; //Set by newGrowableBuffer and views of it, NULL for fixed buffers.
+    uint32_t       generation; //growable->generation when this copy was taken.
 } VKBUFFER;
 
-VKBUFFER newBuffer(VKCTX ctx, VkDeviceSize size, BufferLocation where);
-void destroyBuffer(VKCTX ctx, VKBUFFER buf);
+//Storage behind a growable buffer, shared by every copy of its VKBUFFER.
+struct VKGROWABLE {
+    VKBUFFER storage; //storage.size is the capacity.
+    VkDeviceSize size;
+    uint32_t generation; //Bumped by every growBuffer.
+};
 
-static inline void* mapBuffer(VKCTX ctx, VKBUFFER b) {
-    void* p; vkMapMemory(ctx.device, b.memory, 0, b.size, 0, &p); return p;
-}
+//A copy of a growable buffer taken before growBuffer still names the old storage.
+static inline bool isStale(VKBUFFER b) { return b.growable && b.generation != b.growable->generation; }
 
-static inline void unmapBuffer(VKCTX ctx, VKBUFFER b) { 
-    vkUnmapMemory(ctx.device, b.memory); 
+//b itself for fixed buffers, the latest storage and size for growable ones. Views of a growable
+//buffer keep their offset and size inside its latest storage.
+static inline VKBUFFER currentBuffer(VKBUFFER b) {
+    if (!b.growable) return b;
+    VKBUFFER cur = b.growable->storage;
+    cur.size = b.growable->size;
+    cur.growable = b.growable;
+    cur.generation = b.growable->generation;
+    if (!b.view) return cur;
+    cur.offset += b.view_offset;
+    if (cur.mapped) cur.mapped = (char*)cur.mapped + b.view_offset;
+    cur.size = b.size;
+    cur.view = true;
+    cur.view_offset = b.view_offset;
+    return cur;
 }
+
+//Returns a buffer with a VK_NULL_HANDLE buffer when it would exceed the memory budget or limit.
+VKBUFFER newBuffer(VKCTX ctx, VkDeviceSize size, BufferLocation where);
+//Wraps existing host memory, such as an mmap'd file, as a buffer without copying it. ptr must be
+//aligned to minImportedHostPointerAlignment and size is rounded up to it, so the tail of the last
+//page must be addressable. The memory must outlive the buffer. Returns a VK_NULL_HANDLE buffer
+//when VK_EXT_external_memory_host is unavailable or the pointer cannot be imported.
+VKBUFFER newBufferFromHostPointer(VKCTX ctx, void* ptr, VkDeviceSize size);
+bool swarmHasSharedMemory(VKCTX ctx);
+//A buffer whose capacity grows geometrically, so repeated growBuffer calls copy O(n) bytes in total.
+VKBUFFER newGrowableBuffer(VKCTX ctx, VkDeviceSize size, BufferLocation where);
+//Resizes buf to size, keeping its contents. When the capacity is exceeded the contents are copied
+//on the GPU into storage of max(size, 2 * capacity) and the old storage is freed once no
+//submission uses it. Host-visible storage waits for the copy, so buf->mapped can be written at once.
+//Programs rebind on their next dispatch, sequences must be recreated.
+//Returns false, leaving buf as it was, when the new storage does not fit the memory budget.
+bool growBuffer(VKCTX ctx, VKBUFFER* buf, VkDeviceSize size);
+//A window of buf that binds, copies and dispatches like a buffer of its own. offset must be a
+//multiple of minStorageBufferOffsetAlignment. Views are not destroyed, only the buffer they came from.
+//A view of a growable buffer follows growBuffer to the new storage, at the same offset and size.
+VKBUFFER bufferView(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize range);
+//Needed around direct .mapped access when memory_flags lacks HOST_COHERENT, no-ops otherwise.
+//swarmUpload and swarmDownload call them themselves.
+void swarmFlush(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize size);
+void swarmInvalidate(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize size);
+//Frees buf once every submission made so far has finished, outstanding tickets stay valid.
+void destroyBuffer(VKCTX ctx, VKBUFFER buf);
+
+//Host-visible buffers are mapped for their whole lifetime, these are kept for old callers.
+static inline void* mapBuffer(VKCTX ctx, VKBUFFER b) { return b.mapped; }
+static inline void unmapBuffer(VKCTX ctx, VKBUFFER b) { }
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "vk_cache.h"
+#include <unistd.h>
+
+uint64_t swarmFnv1a(const void* data, size_t size){
+    const uint8_t* p = data;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+//Whole file into a malloc'd buffer the caller frees. False when it is missing or unreadable.
+bool swarmReadFile(const char* path, void** data, size_t* size){
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (n <= 0) {
+        fclose(f);
+        return false;
+    }
+    *data = XMALLOC(n);
+    *size = n;
+    bool ok = fread(*data, 1, n, f) == (size_t)n;
+    fclose(f);
+    if (!ok) free(*data);
+    return ok;
+}
+
+//Writes to a temporary file and renames it over path, so readers and crashes never see half a file.
+bool swarmWriteFileAtomic(const char* path, const void* head, size_t head_size, const void* data, size_t data_size){
+    size_t len = strlen(path) + 32;
+    char* tmp = XMALLOC(len);
+    snprintf(tmp, len, "%s.tmp.%d", path, (int)getpid());
+
+    FILE* f = fopen(tmp, "wb");
+    bool ok = f != NULL;
+    if (ok) {
+        ok = fwrite(head, 1, head_size, f) == head_size;
+        if (ok && data_size) ok = fwrite(data, 1, data_size, f) == data_size;
+        ok = fflush(f) == 0 && ok;
+        ok = fsync(fileno(f)) == 0 && ok;
+        ok = fclose(f) == 0 && ok;
+    }
+    if (ok) ok = rename(tmp, path) == 0;
+    if (!ok) {
+        fprintf(stderr, "Could not write %s\n", path);
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+//Initial data from the file, or NULL when it is missing or made by another device or driver.
+static void* loadCacheData(const char* path, const PipelineCacheHeader* expected, size_t* size){
+    void* file;
+    size_t file_size;
+    if (!swarmReadFile(path, &file, &file_size)) return NULL;
+
+    PipelineCacheHeader h;
+    const char* reason = NULL;
+    if (file_size < sizeof(h)) {
+        reason = "truncated";
+    } else {
+        memcpy(&h, file, sizeof(h));
+        if (h.magic != PIPELINE_CACHE_MAGIC || h.version != PIPELINE_CACHE_VERSION) reason = "unknown format";
+        else if (h.vendor_id != expected->vendor_id || h.device_id != expected->device_id) reason = "other device";
+        else if (h.driver_version != expected->driver_version) reason = "other driver version";
+        else if (memcmp(h.uuid, expected->uuid, VK_UUID_SIZE)) reason = "other pipelineCacheUUID";
+        else if (h.data_size != file_size - sizeof(h)) reason = "truncated";
+        else if (h.data_hash != swarmFnv1a((char*)file + sizeof(h), h.data_size)) reason = "corrupt";
+    }
+    if (reason) {
+        printf("Ignoring pipeline cache %s: %s\n", path, reason);
+        free(file);
+        return NULL;
+    }
+
+    memmove(file, (char*)file + sizeof(h), h.data_size);
+    *size = h.data_size;
+    return file;
+}
+
+VKPIPELINECACHE* createPipelineCache(VkDevice device, VkPhysicalDevice phys, bool feedback){
+    VKPIPELINECACHE* c = XMALLOC(sizeof(VKPIPELINECACHE));
+    memset(c, 0, sizeof(VKPIPELINECACHE));
+    c->feedback = feedback;
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(phys, &props);
+    c->header.magic = PIPELINE_CACHE_MAGIC;
+    c->header.version = PIPELINE_CACHE_VERSION;
+    c->header.vendor_id = props.vendorID;
+    c->header.device_id = props.deviceID;
+    c->header.driver_version = props.driverVersion;
+    memcpy(c->header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+
+    const char* path = getenv("SWARM_PIPELINE_CACHE");
+    if (!path) path = PIPELINE_CACHE_DEFAULT_PATH;
+    void* data = NULL;
+    size_t size = 0;
+    if (*path) {
+        c->path = XMALLOC(strlen(path) + 1);
+        strcpy(c->path, path);
+        data = loadCacheData(path, &c->header, &size);
+    }
+
+    VkPipelineCacheCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = size,
+        .pInitialData = data
+    };
+    VK_CHECK(vkCreatePipelineCache(device, &ci, NULL, &c->cache));
+    if (data) printf("Loaded %zu bytes of pipeline cache from %s\n", size, path);
+    free(data);
+    return c;
+}
+
+static bool saveCache(VkDevice device, VKPIPELINECACHE* c){
+    if (!c->path) return true;
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, c->cache, &size, NULL));
+    void* data = size ? XMALLOC(size) : NULL;
+    if (size) VK_CHECK(vkGetPipelineCacheData(device, c->cache, &size, data));
+
+    PipelineCacheHeader h = c->header;
+    h.data_size = size;
+    h.data_hash = swarmFnv1a(data, size);
+    bool ok = swarmWriteFileAtomic(c->path, &h, sizeof(h), data, size);
+    free(data);
+    return ok;
+}
+
+bool swarmSavePipelineCache(VKCTX ctx){
+    return saveCache(ctx.device, ctx.pipeline_cache);
+}
+
+void destroyPipelineCache(VkDevice device, VKPIPELINECACHE* c){
+    if (c->hits + c->misses) saveCache(device, c); //Nothing new to save when no pipeline was made.
+    vkDestroyPipelineCache(device, c->cache, NULL);
+    free(c->path);
+    free(c);
+}
+
+void reportPipelineFeedback(VKPIPELINECACHE* c, const char* name, const VkPipelineCreationFeedbackEXT* feedback){
+    if (!c->feedback || !(feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+        c->misses++;
+        return;
+    }
+    bool hit = feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT;
+    if (hit) c->hits++;
+    else c->misses++;
+    printf("Pipeline %s: %s in %.2f ms\n", name, hit ? "cache hit" : "compiled", feedback->duration / 1e6);
+}
@@ -0,0 +1,46 @@
+#ifndef VK_CACHE_H
+#define VK_CACHE_H
+
+#include "vk_setup.h"
+#include <stdbool.h>
+
+#define PIPELINE_CACHE_MAGIC 0x43505753u //"SWPC"
+#define PIPELINE_CACHE_VERSION 1
+#define PIPELINE_CACHE_DEFAULT_PATH "swarm_pipeline_cache.bin"
+
+//Prefix of the cache file. The driver checks its own blob too, but not the driver version, and a
+//truncated file would only be caught by the checksum.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t uuid[VK_UUID_SIZE]; //pipelineCacheUUID.
+    uint64_t data_size;
+    uint64_t data_hash; //fnv1a of the data.
+} PipelineCacheHeader;
+
+struct VKPIPELINECACHE {
+    VkPipelineCache cache;
+    char* path; //NULL when persistence is off.
+    PipelineCacheHeader header; //Of this device, written on save and compared on load.
+    bool feedback; //VK_EXT_pipeline_creation_feedback is enabled.
+    uint32_t hits;
+    uint32_t misses;
+};
+
+uint64_t swarmFnv1a(const void* data, size_t size);
+bool swarmReadFile(const char* path, void** data, size_t* size);
+bool swarmWriteFileAtomic(const char* path, const void* head, size_t head_size, const void* data, size_t data_size);
+
+//Loaded from $SWARM_PIPELINE_CACHE, or PIPELINE_CACHE_DEFAULT_PATH when unset. Set it to an empty
+//string to keep the cache in memory only.
+VKPIPELINECACHE* createPipelineCache(VkDevice device, VkPhysicalDevice phys, bool feedback);
+void destroyPipelineCache(VkDevice device, VKPIPELINECACHE* c);
+//Logs whether the driver found the pipeline in the cache, from VkPipelineCreationFeedback.
+void reportPipelineFeedback(VKPIPELINECACHE* c, const char* name, const VkPipelineCreationFeedbackEXT* feedback);
+
+//Writes the cache now, destroyVkContext also does. Returns false when the file cannot be written.
+bool swarmSavePipelineCache(VKCTX ctx);
+#endif
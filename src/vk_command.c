@@ -1,117 +1,814 @@
 #include "vk_command.h"
+#include "vk_profile.h"
+#include "vk_memory.h"
+
+//The queue, pool and timeline a submission goes through.
+typedef struct {
+    VkQueue queue;
+    VkCommandPool pool;
+    VKTIMELINE* timeline;
+    VKTIMELINE* other; //Timeline of the other queue, waited on when a buffer is shared with it.
+} Lane;
+
+static Lane computeLane(VKCTX ctx){
+    return (Lane){ ctx.queue, ctx.command_pool, ctx.timeline, ctx.transfer_timeline };
+}
+
+static Lane transferLane(VKCTX ctx){
+    return (Lane){ ctx.transfer_queue, ctx.transfer_command_pool, ctx.transfer_timeline, ctx.timeline };
+}
+
+//Resets cmd and keeps it for the next submission instead of freeing it.
+static void recycleCommand(VKTIMELINE* t, VkCommandBuffer cmd){
+    VK_CHECK(vkResetCommandBuffer(cmd, 0));
+    if (t->free_count == t->free_capacity) {
+        t->free_capacity = t->free_capacity ? t->free_capacity * 2 : 8;
+        XREALLOC(t->free_cmds, t->free_capacity * sizeof(VkCommandBuffer));
+    }
+    t->free_cmds[t->free_count++] = cmd;
+}
+
+//Recycles the command buffers and forgets the buffers of every submission the GPU has finished.
+static void retireTimeline(VKCTX ctx, VKTIMELINE* t){
+    if (t->pending_count == 0 && t->buffer_count == 0) return;
+
+    uint64_t done;
+    VK_CHECK(vkGetSemaphoreCounterValue(ctx.device, t->semaphore, &done));
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < t->pending_count; ++i) {
+        if (t->pending[i].value <= done) {
+            recycleCommand(t, t->pending[i].cmd);
+        } else {
+            t->pending[kept++] = t->pending[i];
+        }
+    }
+    t->pending_count = kept;
+
+    kept = 0;
+    for (uint32_t i = 0; i < t->buffer_count; ++i)
+        if (t->buffers[i].value > done) t->buffers[kept++] = t->buffers[i];
+    t->buffer_count = kept;
+}
+
+static void retireCommands(VKCTX ctx){
+    retireTimeline(ctx, ctx.timeline);
+    retireTimeline(ctx, ctx.transfer_timeline);
+    releaseRetired(ctx);
+    profileResolve(ctx);
+}
+
+static inline BufferRange rangeOf(VKBUFFER b){
+    return (BufferRange){ b.buffer, b.offset, b.size };
+}
+
+static inline bool overlaps(BufferRange a, BufferRange b){
+    return a.buffer == b.buffer && a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+}
+
+//Latest value of t whose submission touches one of the given ranges, 0 if none is in flight.
+static uint64_t conflictingValue(VKTIMELINE* t, const BufferRange* buffers, uint32_t buffer_count){
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < t->buffer_count; ++i)
+        for (uint32_t j = 0; j < buffer_count; ++j)
+            if (overlaps(t->buffers[i].range, buffers[j]) && t->buffers[i].value > value)
+                value = t->buffers[i].value;
+    return value;
+}
+
+//Submits cmd so it runs after all previous submissions on its queue, and after submissions on
+//the other queue that touch one of the same buffers.
+static VKTICKET submitToQueue(VKCTX ctx, Lane lane, VkCommandBuffer cmd, const BufferRange* buffers, uint32_t buffer_count){
+    VKTIMELINE* t = lane.timeline;
+    retireCommands(ctx);
+
+    VkSemaphore wait_semaphores[2] = { t->semaphore, lane.other->semaphore };
+    uint64_t wait_values[2] = { t->value, conflictingValue(lane.other, buffers, buffer_count) };
+    VkPipelineStageFlags wait_stages[2] = { VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+    uint32_t wait_count = wait_values[1] ? 2 : 1;
+    uint64_t signal_value = t->value + 1;
+
+    VkTimelineSemaphoreSubmitInfo tsi = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = wait_count,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signal_value,
+    };
+    VkSubmitInfo si = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &tsi,
+        .waitSemaphoreCount = wait_count,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stages,
+        .commandBufferCount = 1,
+        .pCommandBuffers    = &cmd,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &t->semaphore,
+    };
+    VK_CHECK(vkQueueSubmit(lane.queue, 1, &si, VK_NULL_HANDLE));
+    t->value = signal_value;
+    VKTICKET ticket = { .semaphore = t->semaphore, .value = signal_value };
+    profileSubmitted(ctx, ticket);
+
+    if (t->buffer_count + buffer_count > t->buffer_capacity) {
+        while (t->buffer_count + buffer_count > t->buffer_capacity)
+            t->buffer_capacity = t->buffer_capacity ? t->buffer_capacity * 2 : 16;
+        XREALLOC(t->buffers, t->buffer_capacity * sizeof(PendingBuffer));
+    }
+    for (uint32_t i = 0; i < buffer_count; ++i)
+        t->buffers[t->buffer_count++] = (PendingBuffer){ .range = buffers[i], .value = signal_value };
+    return ticket;
+}
+
+//Submits a one-shot cmd and hands ownership of it to the timeline, which recycles it once retired.
+static VKTICKET submitCommand(VKCTX ctx, Lane lane, VkCommandBuffer cmd, const BufferRange* buffers, uint32_t buffer_count){
+    VKTIMELINE* t = lane.timeline;
+    VKTICKET ticket = submitToQueue(ctx, lane, cmd, buffers, buffer_count);
+    if (t->pending_count == t->pending_capacity) {
+        t->pending_capacity = t->pending_capacity ? t->pending_capacity * 2 : 8;
+        XREALLOC(t->pending, t->pending_capacity * sizeof(PendingCommand));
+    }
+    t->pending[t->pending_count++] = (PendingCommand){ .cmd = cmd, .value = ticket.value };
+    return ticket;
+}
+
+//Takes a retired command buffer from the lane's pool, only allocating when none is free.
+static VkCommandBuffer allocateCommand(VKCTX ctx, Lane lane){
+    if (lane.timeline->free_count)
+        return lane.timeline->free_cmds[--lane.timeline->free_count];
 
-void runCopyCommand(VKCTX ctx, VKBUFFER from, VKBUFFER to, uint32_t from_offset, uint32_t to_offset, uint32_t size){
     VkCommandBufferAllocateInfo allocInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = ctx.command_pool,
+        .commandPool = lane.pool,
         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
         .commandBufferCount = 1
     };
     VkCommandBuffer cmd;
     VK_CHECK(vkAllocateCommandBuffers(ctx.device, &allocInfo, &cmd));
+    return cmd;
+}
+
+//Appends the range of buf to list unless it is already in it.
+static void addBuffer(BufferRange* list, uint32_t* count, VKBUFFER buf){
+    buf = currentBuffer(buf);
+    if (buf.buffer == VK_NULL_HANDLE) return;
+    BufferRange r = rangeOf(buf);
+    for (uint32_t i = 0; i < *count; ++i)
+        if (list[i].buffer == r.buffer && list[i].offset == r.offset && list[i].size == r.size) return;
+    list[(*count)++] = r;
+}
+
+//Distinct buffers a compute chain binds, plus the buffers its dispatch arguments come from. Caller frees.
+static BufferRange* collectBuffers(VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect, uint32_t* count){
+    size_t max = 1;
+    for (uint32_t i = 0; i < program_count; ++i) max += programs[i].buffer_count + 1;
+
+    BufferRange* list = XMALLOC(max * sizeof(BufferRange));
+    *count = 0;
+    addBuffer(list, count, indirect);
+    for (uint32_t i = 0; i < program_count; ++i) {
+        if (programs[i].dispatch.type == DISPATCH_INDIRECT)
+            addBuffer(list, count, programs[i].dispatch.buffer);
+        for (uint32_t j = 0; j < programs[i].buffer_count; ++j)
+            addBuffer(list, count, programs[i].buffers[j]);
+    }
+    return list;
+}
+
+//Rebinds programs that still use storage a growBuffer has replaced.
+static void refreshBindings(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count){
+    for (uint32_t i = 0; i < program_count; ++i) {
+        VKPROGRAM* prog = &programs[i];
+        prog->dispatch.buffer = currentBuffer(prog->dispatch.buffer);
+        bool stale = false;
+        for (uint32_t j = 0; j < prog->buffer_count; ++j) stale |= isStale(prog->buffers[j]);
+        if (!stale) continue;
+        VKBUFFER current[MAX_BUFFERS];
+        for (uint32_t j = 0; j < prog->buffer_count; ++j) current[j] = currentBuffer(prog->buffers[j]);
+        useBuffers(ctx, prog, current, prog->buffer_count);
+    }
+}
+
+void swarmWait(VKCTX ctx, VKTICKET ticket){
+    VkSemaphoreWaitInfo wi = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &ticket.semaphore,
+        .pValues = &ticket.value,
+    };
+    VK_CHECK(vkWaitSemaphores(ctx.device, &wi, UINT64_MAX));
+    retireCommands(ctx);
+}
+
+bool swarmPoll(VKCTX ctx, VKTICKET ticket){
+    uint64_t done;
+    VK_CHECK(vkGetSemaphoreCounterValue(ctx.device, ticket.semaphore, &done));
+    if (done < ticket.value) return false;
+    retireCommands(ctx);
+    return true;
+}
+
+//Records the regions in list order. Consecutive regions between the same two buffers share one
+//vkCmdCopyBuffer, and a barrier goes in before a region that touches what an earlier one wrote or
+//overwrites what an earlier one reads.
+static void recordCopies(VKCTX ctx, VkCommandBuffer cmd, const VKCOPY* copies, uint32_t copy_count, uint32_t queue){
+    VkBufferCopy* regions = XMALLOC(copy_count * sizeof(VkBufferCopy));
+    BufferRange* reads = XMALLOC(copy_count * sizeof(BufferRange)); //Since the last barrier.
+    BufferRange* writes = XMALLOC(copy_count * sizeof(BufferRange));
+    uint32_t n = 0, access_count = 0;
+    VkBuffer src = VK_NULL_HANDLE, dst = VK_NULL_HANDLE;
+    uint32_t query = profileBegin(ctx, cmd, queue, "copy");
+    for (uint32_t i = 0; i < copy_count; ++i) {
+        VKBUFFER from = currentBuffer(copies[i].from);
+        VKBUFFER to = currentBuffer(copies[i].to);
+        BufferRange r = { from.buffer, from.offset + copies[i].from_offset, copies[i].size };
+        BufferRange w = { to.buffer, to.offset + copies[i].to_offset, copies[i].size };
+        bool dependent = false;
+        for (uint32_t j = 0; j < access_count && !dependent; ++j)
+            dependent = overlaps(r, writes[j]) || overlaps(w, writes[j]) || overlaps(w, reads[j]);
+
+        if (n && (dependent || from.buffer != src || to.buffer != dst)) {
+            vkCmdCopyBuffer(cmd, src, dst, n, regions);
+            n = 0;
+        }
+        if (dependent) {
+            VkMemoryBarrier barrier = {
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+            };
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0, 1, &barrier, 0, NULL, 0, NULL);
+            access_count = 0;
+        }
+        src = from.buffer;
+        dst = to.buffer;
+        regions[n++] = (VkBufferCopy){ .srcOffset = r.offset, .dstOffset = w.offset, .size = copies[i].size };
+        reads[access_count] = r;
+        writes[access_count++] = w;
+    }
+    if (n) vkCmdCopyBuffer(cmd, src, dst, n, regions);
+    profileEnd(ctx, cmd, query);
+    free(writes);
+    free(reads);
+    free(regions);
+}
+
+//Copies run on the transfer queue so uploads and readbacks can overlap compute work.
+static VKTICKET submitCopies(VKCTX ctx, const VKCOPY* copies, uint32_t copy_count){
+    Lane lane = transferLane(ctx);
+    VkCommandBuffer cmd = allocateCommand(ctx, lane);
 
     VkCommandBufferBeginInfo beginInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
     };
     VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+    recordCopies(ctx, cmd, copies, copy_count, PROFILE_TRANSFER);
+    VkMemoryBarrier host = {
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &host, 0, NULL, 0, NULL);
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    BufferRange* buffers = XMALLOC(2 * copy_count * sizeof(BufferRange));
+    uint32_t buffer_count = 0;
+    for (uint32_t i = 0; i < copy_count; ++i) {
+        addBuffer(buffers, &buffer_count, copies[i].from);
+        addBuffer(buffers, &buffer_count, copies[i].to);
+    }
+    VKTICKET ticket = submitCommand(ctx, lane, cmd, buffers, buffer_count);
+    free(buffers);
+    return ticket;
+}
+
+//Exits on regions vkCmdCopyBuffer does not allow: empty, outside either buffer, or copying a range onto itself.
+static void checkCopy(const VKCOPY* copy, uint32_t index){
+    VKBUFFER from = currentBuffer(copy->from);
+    VKBUFFER to = currentBuffer(copy->to);
+    const char* problem = NULL;
+    if (copy->size == 0) problem = "is empty";
+    else if (copy->from_offset > from.size || copy->size > from.size - copy->from_offset) problem = "reads past the end of its source";
+    else if (copy->to_offset > to.size || copy->size > to.size - copy->to_offset) problem = "writes past the end of its destination";
+    else if (overlaps((BufferRange){ from.buffer, from.offset + copy->from_offset, copy->size },
+                      (BufferRange){ to.buffer, to.offset + copy->to_offset, copy->size })) problem = "overlaps its own source";
+    if (!problem) return;
+    fprintf(stderr, "runCopyListCommand: region %u (%llu bytes from %llu to %llu) %s\n", index, (unsigned long long)copy->size,
+            (unsigned long long)copy->from_offset, (unsigned long long)copy->to_offset, problem);
+    exit(1);
+}
 
-    VkBufferCopy copyRegion = {
-        .srcOffset = from_offset,
-        .dstOffset = to_offset,
+VKTICKET runCopyListCommandAsync(VKCTX ctx, const VKCOPY* copies, uint32_t copy_count){
+    if (copy_count == 0) {
+        fprintf(stderr, "runCopyListCommand: the copy list is empty\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < copy_count; ++i) checkCopy(&copies[i], i);
+    swarmSubmitTransfers(ctx);
+    return submitCopies(ctx, copies, copy_count);
+}
+
+void runCopyListCommand(VKCTX ctx, const VKCOPY* copies, uint32_t copy_count){
+    swarmWait(ctx, runCopyListCommandAsync(ctx, copies, copy_count));
+}
+
+VKTICKET runCopyCommandAsync(VKCTX ctx, VKBUFFER from, VKBUFFER to, VkDeviceSize from_offset, VkDeviceSize to_offset, VkDeviceSize size){
+    VKCOPY copy = {
+        .from = from,
+        .to = to,
+        .from_offset = from_offset,
+        .to_offset = to_offset,
         .size = size
     };
-    vkCmdCopyBuffer(cmd, from.buffer, to.buffer, 1, &copyRegion);
+    return runCopyListCommandAsync(ctx, &copy, 1);
+}
 
-    VK_CHECK(vkEndCommandBuffer(cmd));
-    VkSubmitInfo si = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers    = &cmd,
-    };
-    VkFenceCreateInfo fi = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-    VkFence fence;
-    VK_CHECK(vkCreateFence(ctx.device, &fi, NULL, &fence));
-    vkQueueSubmit(ctx.queue, 1, &si, fence);
-    vkWaitForFences(ctx.device, 1, &fence, VK_TRUE, UINT64_MAX);
-    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &cmd);
-    vkDestroyFence(ctx.device, fence, NULL);
+void runCopyCommand(VKCTX ctx, VKBUFFER from, VKBUFFER to, VkDeviceSize from_offset, VkDeviceSize to_offset, VkDeviceSize size){
+    swarmWait(ctx, runCopyCommandAsync(ctx, from, to, from_offset, to_offset, size));
 }
 
-void runComputeCommand(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect){
-    VkCommandBufferAllocateInfo cbai = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = ctx.command_pool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1
-    };
+//Buffer the program's dispatch arguments are read from, a null range for direct dispatches.
+static BufferRange dispatchSource(VKPROGRAM* program, VKBUFFER indirect){
+    switch (program->dispatch.type) {
+    case DISPATCH_DEFAULT:  return rangeOf(indirect);
+    case DISPATCH_INDIRECT: return rangeOf(program->dispatch.buffer);
+    default:                return (BufferRange){ VK_NULL_HANDLE, 0, 0 };
+    }
+}
 
-    VkCommandBuffer cmd;
-    vkAllocateCommandBuffers(ctx.device, &cbai, &cmd);
+static void recordDispatch(VkCommandBuffer cmd, VKPROGRAM* program, VKBUFFER indirect){
+    VKDISPATCH d = program->dispatch;
+    switch (d.type) {
+    case DISPATCH_DEFAULT:
+        if (indirect.buffer == VK_NULL_HANDLE) {
+            fprintf(stderr, "Program has no dispatch source and no indirect buffer was given.\n");
+            exit(1);
+        }
+        vkCmdDispatchIndirect(cmd, indirect.buffer, indirect.offset);
+        break;
+    case DISPATCH_DIRECT:
+        vkCmdDispatch(cmd, d.x, d.y, d.z);
+        break;
+    case DISPATCH_INDIRECT:
+        vkCmdDispatchIndirect(cmd, d.buffer.buffer, d.buffer.offset + d.offset);
+        break;
+    case DISPATCH_ELEMENTS:
+        vkCmdDispatch(cmd,
+                      (d.x + program->local_size[0] - 1) / program->local_size[0],
+                      (d.y + program->local_size[1] - 1) / program->local_size[1],
+                      (d.z + program->local_size[2] - 1) / program->local_size[2]);
+        break;
+    }
+}
 
-    VkCommandBufferBeginInfo bi = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
-    };
+//Per-range access state since the last barrier that covered it.
+typedef struct {
+    BufferRange range;
+    bool written; //Shader writes not yet made visible.
+    bool read;    //Reads a later write must wait for.
+} Hazard;
 
-    vkBeginCommandBuffer(cmd, &bi);
-    VkBufferMemoryBarrier b = {
+static Hazard* findHazard(Hazard* hazards, uint32_t* count, BufferRange range){
+    for (uint32_t i = 0; i < *count; ++i)
+        if (hazards[i].range.buffer == range.buffer && hazards[i].range.offset == range.offset && hazards[i].range.size == range.size)
+            return &hazards[i];
+    hazards[*count] = (Hazard){ .range = range };
+    return &hazards[(*count)++];
+}
+
+//Adds dst_access to the barrier on range, creating it if needed.
+static void addBarrier(VkBufferMemoryBarrier* barriers, uint32_t* count, BufferRange range, VkAccessFlags dst_access){
+    for (uint32_t i = 0; i < *count; ++i) {
+        if (barriers[i].buffer == range.buffer && barriers[i].offset == range.offset && barriers[i].size == range.size) {
+            barriers[i].dstAccessMask |= dst_access;
+            return;
+        }
+    }
+    barriers[(*count)++] = (VkBufferMemoryBarrier){
         .sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-        .srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT,
-        .dstAccessMask       = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        .srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask       = dst_access,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .buffer              = indirect.buffer,
-        .offset              = 0,
-        .size                = indirect.size
+        .buffer              = range.buffer,
+        .offset              = range.offset,
+        .size                = range.size
     };
-    vkCmdPipelineBarrier(cmd,
-                        VK_PIPELINE_STAGE_TRANSFER_BIT,
-                        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
-                        0, 0, NULL, 1, &b, 0, NULL);
-    for(int i = 0; i < program_count; i++){        
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, programs[i].pipeline);
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, programs[i].pipeline_layout, 0, 1, &programs[i].descriptor_set, 0, NULL);
-        
-        vkCmdDispatchIndirect(cmd, indirect.buffer, 0);
-        //vkCmdDispatch(cmd, 1, 1, 1);
-        VkBufferMemoryBarrier barriers[programs[i].buffer_count]; //Should be the max amount of barriers possible for the given buffers.
-        uint32_t barrierCount = 0;
-
-        for (uint32_t j = 0; j < programs[i].buffer_count; ++j) {
-            BindingLimitations lim = programs[i].binding_read_write_limitations[j];
-            if (lim == WRITE_ONLY || lim == READ_AND_WRITE) {
-                barriers[barrierCount++] = (VkBufferMemoryBarrier){
-                    .sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-                    .srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT,
-                    .dstAccessMask       = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT,
-                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-                    .buffer              = programs[i].buffers[j].buffer,
-                    .offset              = 0,
-                    .size                = VK_WHOLE_SIZE
-                };
+}
+
+//Records the dispatch chain into an open command buffer. A barrier is only inserted before a
+//dispatch that has a RAW, WAR or WAW hazard with an earlier one, so independent dispatches may
+//overlap. Work in other submissions is ordered by the timeline semaphores instead.
+//Profiled chains get timestamps around every dispatch, replayed sequences cannot reuse them.
+static void recordCompute(VKCTX ctx, VkCommandBuffer cmd, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect, bool profiled){
+    size_t max = 1;
+    for (uint32_t i = 0; i < program_count; ++i) max += programs[i].buffer_count + 1;
+
+    Hazard* hazards = XMALLOC(max * sizeof(Hazard));
+    VkBufferMemoryBarrier* barriers = XMALLOC(max * sizeof(VkBufferMemoryBarrier));
+    uint32_t hazard_count = 0;
+    bool any_written = false;
+
+    for(uint32_t i = 0; i < program_count; i++){
+        VKPROGRAM* prog = &programs[i];
+        uint32_t barrier_count = 0;
+        bool execution_only = false;
+        VkPipelineStageFlags dst_stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+        //Ranges of one block share a VkBuffer, so hazards are checked by overlap rather than handle.
+        BufferRange source = dispatchSource(prog, indirect);
+        for (uint32_t k = 0; source.buffer != VK_NULL_HANDLE && k < hazard_count; ++k) {
+            if (hazards[k].written && overlaps(hazards[k].range, source)) {
+                addBarrier(barriers, &barrier_count, hazards[k].range, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+                dst_stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+            }
+        }
+
+        for (uint32_t j = 0; j < prog->buffer_count; ++j) {
+            BindingLimitations lim = prog->binding_read_write_limitations[j];
+            BufferRange r = rangeOf(prog->buffers[j]);
+            for (uint32_t k = 0; k < hazard_count; ++k) {
+                Hazard* h = &hazards[k];
+                if (!overlaps(h->range, r)) continue;
+                if (lim != WRITE_ONLY && h->written)    /* RAW */
+                    addBarrier(barriers, &barrier_count, h->range, VK_ACCESS_SHADER_READ_BIT);
+                if (lim != READ_ONLY && h->written)     /* WAW */
+                    addBarrier(barriers, &barrier_count, h->range, VK_ACCESS_SHADER_WRITE_BIT);
+                if (lim != READ_ONLY && h->read)        /* WAR, execution dependency only */
+                    execution_only = true;
             }
         }
 
-        if (barrierCount)
+        if (barrier_count || execution_only) {
             vkCmdPipelineBarrier(cmd,
-                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,   /* producer stage */
-                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |  /* consumer stage */
-                                 VK_PIPELINE_STAGE_HOST_BIT,
-                                 0, 0, NULL, barrierCount, barriers, 0, NULL);
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |  /* producer stages */
+                                 VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                                 dst_stages,                             /* consumer stages */
+                                 0, 0, NULL, barrier_count, barriers, 0, NULL);
+
+            //Every earlier dispatch has now finished executing, but only the barriered writes are visible.
+            for (uint32_t k = 0; k < hazard_count; ++k) hazards[k].read = false;
+            for (uint32_t k = 0; k < barrier_count; ++k) {
+                BufferRange r = { barriers[k].buffer, barriers[k].offset, barriers[k].size };
+                findHazard(hazards, &hazard_count, r)->written = false;
+            }
+        }
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, prog->pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, prog->pipeline_layout, 0, 1, &prog->descriptor_set, 0, NULL);
+        if (prog->push_constant_size)
+            vkCmdPushConstants(cmd, prog->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, prog->push_constant_size, prog->push_constants);
+        uint32_t query = profiled ? profileBegin(ctx, cmd, PROFILE_COMPUTE, prog->shader_path) : UINT32_MAX;
+        recordDispatch(cmd, prog, indirect);
+        profileEnd(ctx, cmd, query);
+
+        if (source.buffer != VK_NULL_HANDLE) findHazard(hazards, &hazard_count, source)->read = true;
+        for (uint32_t j = 0; j < prog->buffer_count; ++j) {
+            BindingLimitations lim = prog->binding_read_write_limitations[j];
+            Hazard* h = findHazard(hazards, &hazard_count, rangeOf(prog->buffers[j]));
+            if (lim != WRITE_ONLY) h->read = true;
+            if (lim != READ_ONLY) h->written = any_written = true;
+        }
+    }
+
+    //Host visibility once for the whole submission instead of after every dispatch.
+    if (any_written) {
+        VkMemoryBarrier host = {
+            .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        };
+        vkCmdPipelineBarrier(cmd,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 1, &host, 0, NULL, 0, NULL);
     }
 
+    free(barriers);
+    free(hazards);
+}
+
+VKTICKET runComputeCommandAsync(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect){
+    swarmSubmitTransfers(ctx); //Staged uploads land before the dispatches that read them.
+    refreshBindings(ctx, programs, program_count);
+    indirect = currentBuffer(indirect);
+    Lane lane = computeLane(ctx);
+    VkCommandBuffer cmd = allocateCommand(ctx, lane);
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+
+    vkBeginCommandBuffer(cmd, &bi);
+    recordCompute(ctx, cmd, programs, program_count, indirect, true);
     vkEndCommandBuffer(cmd);
-    VkSubmitInfo si = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers    = &cmd,
+
+    uint32_t buffer_count;
+    BufferRange* buffers = collectBuffers(programs, program_count, indirect, &buffer_count);
+    VKTICKET ticket = submitCommand(ctx, lane, cmd, buffers, buffer_count);
+    free(buffers);
+    return ticket;
+}
+
+void runComputeCommand(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect){
+    swarmWait(ctx, runComputeCommandAsync(ctx, programs, program_count, indirect));
+}
+
+VKSEQUENCE createSequence(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect){
+    VKSEQUENCE seq = {0};
+    refreshBindings(ctx, programs, program_count);
+    indirect = currentBuffer(indirect);
+    seq.cmd = allocateCommand(ctx, computeLane(ctx));
+    seq.buffers = collectBuffers(programs, program_count, indirect, &seq.buffer_count);
+
+    //Simultaneous use so a replay can be queued while the previous one is still executing.
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT
+    };
+    VK_CHECK(vkBeginCommandBuffer(seq.cmd, &bi));
+    recordCompute(ctx, seq.cmd, programs, program_count, indirect, false);
+    VK_CHECK(vkEndCommandBuffer(seq.cmd));
+    return seq;
+}
+
+VKTICKET runSequenceAsync(VKCTX ctx, VKSEQUENCE* seq){
+    swarmSubmitTransfers(ctx);
+    seq->last = submitToQueue(ctx, computeLane(ctx), seq->cmd, seq->buffers, seq->buffer_count);
+    return seq->last;
+}
+
+void runSequence(VKCTX ctx, VKSEQUENCE* seq){
+    swarmWait(ctx, runSequenceAsync(ctx, seq));
+}
+
+void destroySequence(VKCTX ctx, VKSEQUENCE seq){
+    if (seq.last.semaphore != VK_NULL_HANDLE) swarmWait(ctx, seq.last);
+    recycleCommand(ctx.timeline, seq.cmd);
+    free(seq.buffers);
+}
+
+VKFRAMERING createFrameRing(VKCTX ctx, uint32_t frame_count, VkDeviceSize staging_size){
+    VKFRAMERING ring = {0};
+    ring.frame_count = frame_count;
+    ring.current = frame_count - 1;
+    ring.staging_size = staging_size;
+    ring.staging = newBuffer(ctx, staging_size * frame_count, BUF_UPLOAD);
+    if (ring.staging.buffer == VK_NULL_HANDLE) exit(1);
+    ring.staging_mapped = ring.staging.mapped;
+    ring.frames = XMALLOC(frame_count * sizeof(VKFRAME));
+    memset(ring.frames, 0, frame_count * sizeof(VKFRAME));
+    for (uint32_t i = 0; i < frame_count; ++i) {
+        ring.frames[i].cmd = allocateCommand(ctx, computeLane(ctx));
+        ring.frames[i].staging_offset = i * staging_size;
+    }
+    return ring;
+}
+
+//Moves to the next slot, waiting only if the device is still executing that slot's previous step.
+VKFRAME* beginFrame(VKCTX ctx, VKFRAMERING* ring){
+    ring->current = (ring->current + 1) % ring->frame_count;
+    VKFRAME* frame = &ring->frames[ring->current];
+    if (frame->ticket.semaphore != VK_NULL_HANDLE) swarmWait(ctx, frame->ticket);
+    frame->staged = 0;
+    frame->upload_count = 0;
+    return frame;
+}
+
+//Writes data into the frame's staging region and queues its copy ahead of the frame's compute work.
+void frameUpload(VKFRAMERING* ring, VKFRAME* frame, VKBUFFER dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size){
+    VkDeviceSize offset = (frame->staged + 15) & ~(VkDeviceSize)15;
+    if (offset + size > ring->staging_size) {
+        fprintf(stderr, "Frame staging region of %llu bytes is full\n", (unsigned long long)ring->staging_size);
+        exit(1);
+    }
+    memcpy(ring->staging_mapped + frame->staging_offset + offset, data, size);
+    frame->staged = offset + size;
+
+    if (frame->upload_count == frame->upload_capacity) {
+        frame->upload_capacity = frame->upload_capacity ? frame->upload_capacity * 2 : 8;
+        XREALLOC(frame->uploads, frame->upload_capacity * sizeof(VKCOPY));
+    }
+    frame->uploads[frame->upload_count++] = (VKCOPY){
+        .from = ring->staging,
+        .to = dst,
+        .from_offset = frame->staging_offset + offset,
+        .to_offset = dst_offset,
+        .size = size
+    };
+}
+
+//Records the current frame's uploads followed by the compute chain and submits it without waiting.
+VKTICKET submitFrame(VKCTX ctx, VKFRAMERING* ring, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect){
+    swarmSubmitTransfers(ctx);
+    refreshBindings(ctx, programs, program_count);
+    indirect = currentBuffer(indirect);
+    VKFRAME* frame = &ring->frames[ring->current];
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
     };
-    VkFenceCreateInfo fi = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-    VkFence fence;
-    VK_CHECK(vkCreateFence(ctx.device, &fi, NULL, &fence));
-    vkQueueSubmit(ctx.queue, 1, &si, fence);
-    vkWaitForFences(ctx.device, 1, &fence, VK_TRUE, UINT64_MAX);
-    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &cmd);
-    vkDestroyFence(ctx.device, fence, NULL);
-}
\ No newline at end of file
+    VK_CHECK(vkBeginCommandBuffer(frame->cmd, &bi));
+
+    if (frame->upload_count) {
+        swarmFlush(ctx, ring->staging, frame->staging_offset, frame->staged); //Only what this frame wrote.
+        recordCopies(ctx, frame->cmd, frame->uploads, frame->upload_count, PROFILE_COMPUTE);
+        VkMemoryBarrier uploaded = {
+            .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        };
+        vkCmdPipelineBarrier(frame->cmd,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                             0, 1, &uploaded, 0, NULL, 0, NULL);
+    }
+    recordCompute(ctx, frame->cmd, programs, program_count, indirect, true);
+    VK_CHECK(vkEndCommandBuffer(frame->cmd));
+
+    uint32_t buffer_count;
+    BufferRange* buffers = collectBuffers(programs, program_count, indirect, &buffer_count);
+    XREALLOC(buffers, (buffer_count + frame->upload_count) * sizeof(BufferRange));
+    for (uint32_t i = 0; i < frame->upload_count; ++i)
+        addBuffer(buffers, &buffer_count, frame->uploads[i].to);
+
+    frame->ticket = submitToQueue(ctx, computeLane(ctx), frame->cmd, buffers, buffer_count);
+    free(buffers);
+    return frame->ticket;
+}
+
+void destroyFrameRing(VKCTX ctx, VKFRAMERING ring){
+    for (uint32_t i = 0; i < ring.frame_count; ++i) {
+        if (ring.frames[i].ticket.semaphore != VK_NULL_HANDLE) swarmWait(ctx, ring.frames[i].ticket);
+        recycleCommand(ctx.timeline, ring.frames[i].cmd);
+        free(ring.frames[i].uploads);
+    }
+    free(ring.frames);
+    destroyBuffer(ctx, ring.staging);
+}
+
+
+VKSTAGING* createStaging(VkDeviceSize size){
+    VKSTAGING* s = XMALLOC(sizeof(VKSTAGING));
+    memset(s, 0, sizeof(VKSTAGING));
+    s->upload.size = size;
+    s->upload.location = BUF_UPLOAD;
+    s->readback.size = size;
+    s->readback.location = BUF_READBACK;
+    return s;
+}
+
+static void destroyRing(VKCTX ctx, StagingRing* r){
+    if (r->buffer.buffer != VK_NULL_HANDLE) destroyBuffer(ctx, r->buffer);
+    free(r->batches);
+}
+
+void destroyStaging(VKCTX ctx){
+    VKSTAGING* s = ctx.staging;
+    destroyRing(ctx, &s->upload);
+    destroyRing(ctx, &s->readback);
+    free(s->copies);
+    free(s);
+}
+
+//Hands the ring space up to head to the submission behind ticket.
+static void pushBatch(StagingRing* r, VKTICKET ticket){
+    if (r->batch_count == r->batch_capacity) {
+        r->batch_capacity = r->batch_capacity ? r->batch_capacity * 2 : 16;
+        XREALLOC(r->batches, r->batch_capacity * sizeof(StagingBatch));
+    }
+    r->batches[r->batch_count++] = (StagingBatch){ .end = r->head, .ticket = ticket };
+}
+
+static void popBatch(StagingRing* r){
+    r->tail = r->batches[0].end;
+    memmove(r->batches, r->batches + 1, --r->batch_count * sizeof(StagingBatch));
+}
+
+//Submits every staged upload as one transfer submission. Returns a ticket covering all staged
+//transfers so far, even when nothing was pending.
+VKTICKET swarmSubmitTransfers(VKCTX ctx){
+    VKSTAGING* s = ctx.staging;
+    if (s->copy_count == 0)
+        return (VKTICKET){ ctx.transfer_timeline->semaphore, ctx.transfer_timeline->value };
+
+    VKTICKET ticket = submitCopies(ctx, s->copies, s->copy_count);
+    s->copy_count = 0;
+    pushBatch(&s->upload, ticket);
+    s->batch_start = s->upload.head;
+    return ticket;
+}
+
+//Takes size contiguous bytes of r, recycling batches the GPU has retired and waiting for the
+//oldest ones if that is not enough. Returns the byte offset in the ring's buffer.
+static VkDeviceSize reserveStaging(VKCTX ctx, StagingRing* r, VkDeviceSize size){
+    VKSTAGING* s = ctx.staging;
+    if (r->buffer.buffer == VK_NULL_HANDLE) {
+        r->buffer = newBuffer(ctx, r->size, r->location);
+        if (r->buffer.buffer == VK_NULL_HANDLE) exit(1);
+    }
+
+    uint64_t done;
+    VK_CHECK(vkGetSemaphoreCounterValue(ctx.device, ctx.transfer_timeline->semaphore, &done));
+    while (r->batch_count && r->batches[0].ticket.value <= done) popBatch(r);
+
+    //Regions never share a non-coherent atom, so flushing one cannot touch a neighbour.
+    uint64_t align = ctx.allocator->atom_size > 16 ? ctx.allocator->atom_size : 16;
+    uint64_t start = (r->head + align - 1) / align * align;
+    if (start % r->size + size > r->size) start += r->size - start % r->size; //Wrap rather than split.
+    while (start + size - r->tail > r->size) {
+        bool unsubmitted = r == &s->upload && s->copy_count; //Staged uploads own space but no batch yet.
+        if (r->batch_count == 0 && !unsubmitted) { r->tail = start; break; } //Ring is empty.
+        if (r->batch_count == 0) swarmSubmitTransfers(ctx);
+        swarmWait(ctx, r->batches[0].ticket);
+        popBatch(r);
+    }
+    r->head = start + size;
+    return start % r->size;
+}
+
+static void stageCopy(VKSTAGING* s, VKCOPY copy){
+    if (s->copy_count == s->copy_capacity) {
+        s->copy_capacity = s->copy_capacity ? s->copy_capacity * 2 : 16;
+        XREALLOC(s->copies, s->copy_capacity * sizeof(VKCOPY));
+    }
+    s->copies[s->copy_count++] = copy;
+}
+
+//Blocks until no submitted work on either queue touches r, so the host can access it directly.
+static void waitForHostAccess(VKCTX ctx, BufferRange r){
+    VKTIMELINE* timelines[2] = { ctx.timeline, ctx.transfer_timeline };
+    for (uint32_t i = 0; i < 2; ++i) {
+        uint64_t value = conflictingValue(timelines[i], &r, 1);
+        if (value) swarmWait(ctx, (VKTICKET){ timelines[i]->semaphore, value });
+    }
+}
+
+void swarmUpload(VKCTX ctx, VKBUFFER dst, VkDeviceSize dst_offset, const void* src, VkDeviceSize size){
+    VKSTAGING* s = ctx.staging;
+    if (size == 0) return;
+    dst = currentBuffer(dst);
+
+    //Host-visible destinations, such as BUF_SHARED on UMA or ReBAR, are written in place.
+    if (dst.mapped) {
+        waitForHostAccess(ctx, (BufferRange){ dst.buffer, dst.offset + dst_offset, size });
+        memcpy((char*)dst.mapped + dst_offset, src, size);
+        flushMemory(ctx, dst.block, dst.offset + dst_offset, size);
+        return;
+    }
+
+    //Large uploads are streamed, the GPU copies one chunk while the next is written.
+    StagingRing* r = &s->upload;
+    VkDeviceSize chunk = r->size / 4;
+    for (VkDeviceSize done = 0; done < size; ) {
+        VkDeviceSize n = size - done < chunk ? size - done : chunk;
+        VkDeviceSize at = reserveStaging(ctx, r, n);
+        memcpy((char*)r->buffer.mapped + at, (const char*)src + done, n);
+        flushMemory(ctx, r->buffer.block, r->buffer.offset + at, n);
+        stageCopy(s, (VKCOPY){ r->buffer, dst, at, dst_offset + done, n });
+        done += n;
+        if (r->head - s->batch_start >= chunk) swarmSubmitTransfers(ctx);
+    }
+}
+
+void swarmDownload(VKCTX ctx, void* dst, VKBUFFER src, VkDeviceSize src_offset, VkDeviceSize size){
+    VKSTAGING* s = ctx.staging;
+    swarmSubmitTransfers(ctx); //Pending uploads to src must land before it is read.
+    src = currentBuffer(src);
+
+    if (src.mapped) {
+        waitForHostAccess(ctx, (BufferRange){ src.buffer, src.offset + src_offset, size });
+        invalidateMemory(ctx, src.block, src.offset + src_offset, size);
+        memcpy(dst, (char*)src.mapped + src_offset, size);
+        return;
+    }
+
+    //Chunk k+1 is copied by the GPU while chunk k is read out of the ring.
+    StagingRing* r = &s->readback;
+    VkDeviceSize chunk = r->size / 4;
+    VKTICKET prev_ticket = {0};
+    VkDeviceSize prev_at = 0, prev_done = 0, prev_n = 0;
+    for (VkDeviceSize done = 0; done < size; ) {
+        VkDeviceSize n = size - done < chunk ? size - done : chunk;
+        VkDeviceSize at = reserveStaging(ctx, r, n);
+        VKCOPY copy = { src, r->buffer, src_offset + done, at, n };
+        VKTICKET ticket = submitCopies(ctx, &copy, 1);
+        pushBatch(r, ticket);
+        if (prev_n) {
+            swarmWait(ctx, prev_ticket);
+            invalidateMemory(ctx, r->buffer.block, r->buffer.offset + prev_at, prev_n);
+            memcpy((char*)dst + prev_done, (char*)r->buffer.mapped + prev_at, prev_n);
+        }
+        prev_ticket = ticket; prev_at = at; prev_done = done; prev_n = n;
+        done += n;
+    }
+    if (prev_n) {
+        swarmWait(ctx, prev_ticket);
+        invalidateMemory(ctx, r->buffer.block, r->buffer.offset + prev_at, prev_n);
+        memcpy((char*)dst + prev_done, (char*)r->buffer.mapped + prev_at, prev_n);
+    }
+}
@@ -4,7 +4,105 @@
 #include "vk_setup.h"
 #include "vk_buffer.h"
 #include "vk_program.h"
-void runCopyCommand(VKCTX ctx, VKBUFFER from, VKBUFFER to, uint32_t from_offset, uint32_t to_offset, uint32_t size);
+
+#define STAGING_RING_SIZE (64ull << 20)
+
+//One region of a copy list, offsets and size are in bytes.
+typedef struct {
+    VKBUFFER from;
+    VKBUFFER to;
+    VkDeviceSize from_offset;
+    VkDeviceSize to_offset;
+    VkDeviceSize size;
+} VKCOPY;
+
+//A pre-recorded compute chain that can be replayed without re-recording.
+//Bindings, dispatch sources, push constants and barriers are captured at creation, recreate it
+//after changing any of them or growing a buffer it uses.
+typedef struct {
+    VkCommandBuffer cmd;
+    VKTICKET last; //Most recent replay, waited on by destroySequence.
+    BufferRange* buffers; //Buffer ranges the chain touches, used to order it against transfers.
+    uint32_t buffer_count;
+} VKSEQUENCE;
+
+//One in-flight simulation step: its own command buffer, staging region and completion ticket.
+typedef struct {
+    VkCommandBuffer cmd;
+    VKTICKET ticket;
+    VkDeviceSize staging_offset;
+    VkDeviceSize staged;
+    VKCOPY* uploads;
+    uint32_t upload_count;
+    uint32_t upload_capacity;
+} VKFRAME;
+
+//Ring of frames so the host can prepare step t+1 while the device executes step t.
+typedef struct {
+    VKFRAME* frames;
+    uint32_t frame_count;
+    uint32_t current;
+    VKBUFFER staging;
+    char* staging_mapped;
+    VkDeviceSize staging_size; //Per frame.
+} VKFRAMERING;
+
+//Ring space handed to one transfer submission, reusable once the ticket completes.
+typedef struct {
+    uint64_t end;
+    VKTICKET ticket;
+} StagingBatch;
+
+//Host-visible ring of staging space. Positions only grow, a position's byte in the buffer is the
+//position modulo size.
+typedef struct {
+    VKBUFFER buffer; //Allocated on first use.
+    BufferLocation location;
+    VkDeviceSize size;
+    uint64_t head; //Next free position.
+    uint64_t tail; //Oldest position still owned by an unfinished batch.
+    StagingBatch* batches; //Submitted batches, oldest first.
+    uint32_t batch_count;
+    uint32_t batch_capacity;
+} StagingRing;
+
+//Uploads are written through a write-combined ring and downloads read through a host-cached one.
+struct VKSTAGING {
+    StagingRing upload;
+    StagingRing readback;
+    uint64_t batch_start; //Start of the upload copies not yet submitted.
+    VKCOPY* copies;
+    uint32_t copy_count;
+    uint32_t copy_capacity;
+};
+
+void runCopyCommand(VKCTX ctx, VKBUFFER from, VKBUFFER to, VkDeviceSize from_offset, VkDeviceSize to_offset, VkDeviceSize size);
 void runComputeCommand(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect);
+void runCopyListCommand(VKCTX ctx, const VKCOPY* copies, uint32_t copy_count);
+
+//Async variants return as soon as the work is submitted, use swarmWait/swarmPoll on the ticket.
+VKTICKET runCopyCommandAsync(VKCTX ctx, VKBUFFER from, VKBUFFER to, VkDeviceSize from_offset, VkDeviceSize to_offset, VkDeviceSize size);
+VKTICKET runComputeCommandAsync(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect);
+VKTICKET runCopyListCommandAsync(VKCTX ctx, const VKCOPY* copies, uint32_t copy_count);
+void swarmWait(VKCTX ctx, VKTICKET ticket);
+bool swarmPoll(VKCTX ctx, VKTICKET ticket);
+
+VKSEQUENCE createSequence(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect);
+VKTICKET runSequenceAsync(VKCTX ctx, VKSEQUENCE* seq);
+void runSequence(VKCTX ctx, VKSEQUENCE* seq);
+void destroySequence(VKCTX ctx, VKSEQUENCE seq);
+
+VKFRAMERING createFrameRing(VKCTX ctx, uint32_t frame_count, VkDeviceSize staging_size);
+VKFRAME* beginFrame(VKCTX ctx, VKFRAMERING* ring);
+void frameUpload(VKFRAMERING* ring, VKFRAME* frame, VKBUFFER dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size);
+VKTICKET submitFrame(VKCTX ctx, VKFRAMERING* ring, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect);
+void destroyFrameRing(VKCTX ctx, VKFRAMERING ring);
+
+VKSTAGING* createStaging(VkDeviceSize size);
+void destroyStaging(VKCTX ctx);
+//Uploads copy src into the ring and return, the copies go out together with the next submission.
+void swarmUpload(VKCTX ctx, VKBUFFER dst, VkDeviceSize dst_offset, const void* src, VkDeviceSize size);
+void swarmDownload(VKCTX ctx, void* dst, VKBUFFER src, VkDeviceSize src_offset, VkDeviceSize size);
+VKTICKET swarmSubmitTransfers(VKCTX ctx);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,530 @@
+#include "vk_memory.h"
+
+static VkDeviceSize nextPow2(VkDeviceSize x){
+    VkDeviceSize p = 1;
+    while (p < x) p <<= 1;
+    return p;
+}
+
+VKALLOCATOR* createAllocator(VkDevice device, VkPhysicalDevice phys, uint32_t compute_family, uint32_t transfer_family, bool memory_budget, bool host_import){
+    VKALLOCATOR* a = XMALLOC(sizeof(VKALLOCATOR));
+    memset(a, 0, sizeof(VKALLOCATOR));
+    a->physical_device = phys;
+    a->memory_budget = memory_budget;
+    vkGetPhysicalDeviceMemoryProperties(phys, &a->props); //Queried once instead of on every newBuffer.
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(phys, &props);
+    VkDeviceSize align = MEMORY_MIN_NODE;
+    if (props.limits.minStorageBufferOffsetAlignment > align) align = props.limits.minStorageBufferOffsetAlignment;
+    if (props.limits.minUniformBufferOffsetAlignment > align) align = props.limits.minUniformBufferOffsetAlignment;
+    a->min_node = nextPow2(align); //Buddy nodes are aligned to their size, so every offset is aligned too.
+    a->atom_size = props.limits.nonCoherentAtomSize ? props.limits.nonCoherentAtomSize : 1;
+    a->storage_alignment = props.limits.minStorageBufferOffsetAlignment ? props.limits.minStorageBufferOffsetAlignment : 1;
+
+    a->families[0] = compute_family;
+    a->families[1] = transfer_family;
+    a->family_count = compute_family == transfer_family ? 1 : 2;
+
+    if (host_import) {
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT host = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+        };
+        VkPhysicalDeviceProperties2 props2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &host,
+        };
+        vkGetPhysicalDeviceProperties2(phys, &props2);
+        a->get_host_pointer_properties = (PFN_vkGetMemoryHostPointerPropertiesEXT)
+            vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+        if (a->get_host_pointer_properties) a->import_alignment = host.minImportedHostPointerAlignment;
+    }
+
+    //Probe which memory types a block buffer accepts.
+    VkBufferCreateInfo info = {
+        .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size        = a->min_node,
+        .usage       = MEMORY_BLOCK_USAGE,
+        .sharingMode = a->family_count == 2 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = a->family_count == 2 ? 2 : 0,
+        .pQueueFamilyIndices   = a->families,
+    };
+    VkBuffer probe;
+    VK_CHECK(vkCreateBuffer(device, &info, NULL, &probe));
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(device, probe, &req);
+    a->type_bits = req.memoryTypeBits;
+    vkDestroyBuffer(device, probe, NULL);
+
+    //Only UMA and resizable BAR put host-visible memory on the main device heap, a small BAR
+    //window is a separate heap and is too scarce to place buffers in.
+    a->shared_type = UINT32_MAX;
+    const VkMemoryPropertyFlags shared = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+                                       | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                       | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    uint32_t device_heap = UINT32_MAX;
+    for (uint32_t i = 0; i < a->props.memoryTypeCount; ++i) {
+        if (!(a->type_bits & (1u << i))) continue;
+        VkMemoryPropertyFlags f = a->props.memoryTypes[i].propertyFlags;
+        if (device_heap == UINT32_MAX && (f & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+            device_heap = a->props.memoryTypes[i].heapIndex;
+        if (a->shared_type == UINT32_MAX && (f & shared) == shared)
+            a->shared_type = i;
+    }
+    if (a->shared_type != UINT32_MAX && a->props.memoryTypes[a->shared_type].heapIndex != device_heap)
+        a->shared_type = UINT32_MAX;
+    return a;
+}
+
+uint32_t swarmGetMemoryBudget(VKCTX ctx, VKHEAPBUDGET heaps[VK_MAX_MEMORY_HEAPS]){
+    VKALLOCATOR* a = ctx.allocator;
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+    if (a->memory_budget) {
+        VkPhysicalDeviceMemoryProperties2 props = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+            .pNext = &budget,
+        };
+        vkGetPhysicalDeviceMemoryProperties2(a->physical_device, &props);
+    }
+
+    for (uint32_t h = 0; h < a->props.memoryHeapCount; ++h) {
+        VkMemoryHeap heap = a->props.memoryHeaps[h];
+        heaps[h] = (VKHEAPBUDGET){
+            .size = heap.size,
+            .device_local = (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+            .budget = a->memory_budget ? budget.heapBudget[h] : heap.size / 10 * 8,
+            .usage = a->memory_budget ? budget.heapUsage[h] : a->heap_allocated[h],
+            .allocated = a->heap_allocated[h],
+            .limit = a->heap_limit[h],
+        };
+    }
+    return a->props.memoryHeapCount;
+}
+
+void swarmSetMemoryLimit(VKCTX ctx, uint32_t heap, VkDeviceSize limit){
+    if (heap < VK_MAX_MEMORY_HEAPS) ctx.allocator->heap_limit[heap] = limit;
+}
+
+//Whether size more bytes fit in heap under its soft limit and, when known, the driver's budget.
+static bool fitsBudget(VKCTX ctx, uint32_t heap, VkDeviceSize size){
+    VKALLOCATOR* a = ctx.allocator;
+    if (a->heap_limit[heap] && a->heap_allocated[heap] + size > a->heap_limit[heap]) return false;
+    if (!a->memory_budget) return true;
+    VKHEAPBUDGET heaps[VK_MAX_MEMORY_HEAPS];
+    swarmGetMemoryBudget(ctx, heaps);
+    return heaps[heap].usage + size <= heaps[heap].budget;
+}
+
+static void linkBlock(VKALLOCATOR* a, VKBLOCK* block){
+    block->next = a->blocks[block->memory_type];
+    a->blocks[block->memory_type] = block;
+}
+
+static void destroyBlock(VKALLOCATOR* a, VkDevice device, VKBLOCK* block){
+    a->heap_allocated[a->props.memoryTypes[block->memory_type].heapIndex] -= block->allocation_size;
+    if (block->mapped) vkUnmapMemory(device, block->memory);
+    vkDestroyBuffer(device, block->buffer, NULL);
+    vkFreeMemory(device, block->memory, NULL);
+    if (block->free_bits) {
+        for (uint32_t k = 0; k <= block->max_order; k++) free(block->free_bits[k]);
+        free(block->free_bits);
+        free(block->free_counts);
+    }
+    free(block);
+}
+
+void destroyAllocator(VkDevice device, VKALLOCATOR* a){
+    for (uint32_t t = 0; t < VK_MAX_MEMORY_TYPES; t++) {
+        VKBLOCK* block = a->blocks[t];
+        while (block) {
+            VKBLOCK* next = block->next;
+            destroyBlock(a, device, block);
+            block = next;
+        }
+    }
+    //Retired sets die with the descriptor pool.
+    for (uint32_t i = 0; i < a->retired_count; ++i) free(a->retired[i].sets);
+    free(a->retired);
+    free(a);
+}
+
+//Best type with every required flag: each preferred flag present scores, each avoided one costs,
+//and coherence breaks ties. Equal scores keep the driver's order.
+uint32_t findMemoryType(VKCTX ctx, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VkMemoryPropertyFlags avoided){
+    VKALLOCATOR* a = ctx.allocator;
+    uint32_t best = UINT32_MAX;
+    int best_score = 0;
+    for (uint32_t i = 0; i < a->props.memoryTypeCount; ++i) {
+        VkMemoryPropertyFlags f = a->props.memoryTypes[i].propertyFlags;
+        if (!(a->type_bits & (1u << i)) || (f & required) != required) continue;
+        int score = 4 * __builtin_popcount(f & preferred) - 4 * __builtin_popcount(f & avoided)
+                  + ((f & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? 1 : 0);
+        if (best == UINT32_MAX || score > best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    if (best != UINT32_MAX) return best;
+
+    fprintf(stderr, "no suitable memory type\n");
+    exit(1);
+}
+
+//Returns NULL when the block would go over budget or the driver is out of memory.
+static VKBLOCK* createBlock(VKCTX ctx, uint32_t memory_type, VkDeviceSize size, bool dedicated){
+    VKALLOCATOR* a = ctx.allocator;
+    uint32_t heap = a->props.memoryTypes[memory_type].heapIndex;
+
+    VKBLOCK* block = XMALLOC(sizeof(VKBLOCK));
+    memset(block, 0, sizeof(VKBLOCK));
+    block->size = size;
+    block->memory_type = memory_type;
+    block->dedicated = dedicated;
+
+    VkBufferCreateInfo info = {
+        .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size        = size,
+        .usage       = MEMORY_BLOCK_USAGE,
+        .sharingMode = a->family_count == 2 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = a->family_count == 2 ? 2 : 0,
+        .pQueueFamilyIndices   = a->families,
+    };
+    VK_CHECK(vkCreateBuffer(ctx.device, &info, NULL, &block->buffer));
+
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(ctx.device, block->buffer, &req);
+    block->allocation_size = req.size;
+    if (!fitsBudget(ctx, heap, req.size)) {
+        vkDestroyBuffer(ctx.device, block->buffer, NULL);
+        free(block);
+        return NULL;
+    }
+
+    VkMemoryAllocateFlagsInfo flags = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+    };
+
+    VkMemoryAllocateInfo alloc = {
+        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext           = &flags,
+        .allocationSize  = req.size,
+        .memoryTypeIndex = memory_type,
+    };
+
+    VkResult res = vkAllocateMemory(ctx.device, &alloc, NULL, &block->memory);
+    if (res == VK_ERROR_OUT_OF_DEVICE_MEMORY || res == VK_ERROR_OUT_OF_HOST_MEMORY) {
+        vkDestroyBuffer(ctx.device, block->buffer, NULL);
+        free(block);
+        return NULL;
+    }
+    VK_CHECK(res);
+    a->heap_allocated[heap] += req.size;
+    VK_CHECK(vkBindBufferMemory(ctx.device, block->buffer, block->memory, 0));
+
+    //Mapped once for the block's lifetime, a memory object can only be mapped once at a time.
+    if (a->props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        VK_CHECK(vkMapMemory(ctx.device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped));
+
+    if (!dedicated) {
+        while ((a->min_node << block->max_order) < size) block->max_order++;
+        block->free_bits = XMALLOC(sizeof(uint64_t*) * (block->max_order + 1));
+        block->free_counts = XMALLOC(sizeof(uint32_t) * (block->max_order + 1));
+        for (uint32_t k = 0; k <= block->max_order; k++) {
+            VkDeviceSize nodes = size / (a->min_node << k);
+            size_t words = (nodes + 63) / 64;
+            block->free_bits[k] = XMALLOC(sizeof(uint64_t) * words);
+            memset(block->free_bits[k], 0, sizeof(uint64_t) * words);
+            block->free_counts[k] = 0;
+        }
+        block->free_bits[block->max_order][0] = 1; //The whole block starts as one free node.
+        block->free_counts[block->max_order] = 1;
+    }
+
+    linkBlock(a, block);
+    return block;
+}
+
+//Frees the range and the sets once every submission recorded so far has finished, instead of
+//waiting for the queues now. Takes ownership of sets.
+void retireMemory(VKCTX ctx, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size, VKDESCRIPTORSET* sets, uint32_t set_count){
+    VKALLOCATOR* a = ctx.allocator;
+    if (!block && set_count == 0) {
+        free(sets);
+        return;
+    }
+    if (a->retired_count == a->retired_capacity) {
+        a->retired_capacity = a->retired_capacity ? a->retired_capacity * 2 : 8;
+        XREALLOC(a->retired, a->retired_capacity * sizeof(RetiredMemory));
+    }
+    a->retired[a->retired_count++] = (RetiredMemory){
+        .block = block,
+        .offset = offset,
+        .size = size,
+        .sets = sets,
+        .set_count = set_count,
+        .compute_value = ctx.timeline->value,
+        .transfer_value = ctx.transfer_timeline->value
+    };
+}
+
+void releaseRetired(VKCTX ctx){
+    VKALLOCATOR* a = ctx.allocator;
+    if (a->retired_count == 0) return;
+
+    uint64_t compute_done, transfer_done;
+    VK_CHECK(vkGetSemaphoreCounterValue(ctx.device, ctx.timeline->semaphore, &compute_done));
+    VK_CHECK(vkGetSemaphoreCounterValue(ctx.device, ctx.transfer_timeline->semaphore, &transfer_done));
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < a->retired_count; ++i) {
+        RetiredMemory r = a->retired[i];
+        if (r.compute_value > compute_done || r.transfer_value > transfer_done) {
+            a->retired[kept++] = r;
+            continue;
+        }
+        freeDescriptorSets(ctx, r.sets, r.set_count);
+        free(r.sets);
+        if (r.block) freeMemory(ctx, r.block, r.offset, r.size);
+    }
+    a->retired_count = kept;
+}
+
+//Wraps host memory in a dedicated block without copying it. ptr must be aligned to
+//minImportedHostPointerAlignment, size is rounded up to it. Returns NULL if the driver refuses it.
+VKBLOCK* importHostMemory(VKCTX ctx, void* ptr, VkDeviceSize size){
+    VKALLOCATOR* a = ctx.allocator;
+    if (!a->import_alignment || (uintptr_t)ptr % a->import_alignment) return NULL;
+    VkDeviceSize requested = size ? size : 1;
+    size = (size + a->import_alignment - 1) / a->import_alignment * a->import_alignment;
+
+    VkMemoryHostPointerPropertiesEXT host = { .sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT };
+    if (a->get_host_pointer_properties(ctx.device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, ptr, &host) != VK_SUCCESS)
+        return NULL;
+
+    VkExternalMemoryBufferCreateInfo external = {
+        .sType       = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+    };
+    VkBufferCreateInfo info = {
+        .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext       = &external,
+        .size        = size,
+        .usage       = MEMORY_BLOCK_USAGE,
+        .sharingMode = a->family_count == 2 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = a->family_count == 2 ? 2 : 0,
+        .pQueueFamilyIndices   = a->families,
+    };
+    VKBLOCK* block = XMALLOC(sizeof(VKBLOCK));
+    memset(block, 0, sizeof(VKBLOCK));
+    VK_CHECK(vkCreateBuffer(ctx.device, &info, NULL, &block->buffer));
+
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(ctx.device, block->buffer, &req);
+    uint32_t bits = req.memoryTypeBits & host.memoryTypeBits;
+    uint32_t type = UINT32_MAX;
+    for (uint32_t i = 0; i < a->props.memoryTypeCount; ++i) {
+        if (!(bits & (1u << i))) continue;
+        if (type == UINT32_MAX) type = i;
+        if (a->props.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) { type = i; break; }
+    }
+
+    VkImportMemoryHostPointerInfoEXT import = {
+        .sType        = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+        .handleType   = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+        .pHostPointer = ptr,
+    };
+    VkMemoryAllocateFlagsInfo flags = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .pNext = &import,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+    };
+    VkMemoryAllocateInfo alloc = {
+        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext           = &flags,
+        .allocationSize  = size,
+        .memoryTypeIndex = type,
+    };
+    if (type == UINT32_MAX || vkAllocateMemory(ctx.device, &alloc, NULL, &block->memory) != VK_SUCCESS) {
+        vkDestroyBuffer(ctx.device, block->buffer, NULL);
+        free(block);
+        return NULL;
+    }
+    VK_CHECK(vkBindBufferMemory(ctx.device, block->buffer, block->memory, 0));
+
+    block->size = size;
+    block->allocation_size = size;
+    block->memory_type = type;
+    block->dedicated = true;
+    block->imported = true;
+    block->used = size;
+    block->allocation_count = 1;
+    a->heap_allocated[a->props.memoryTypes[type].heapIndex] += size;
+    a->requested += requested;
+    linkBlock(a, block);
+    return block;
+}
+
+static inline bool testNode(VKBLOCK* b, uint32_t k, VkDeviceSize i){ return (b->free_bits[k][i / 64] >> (i % 64)) & 1; }
+static inline void setNode(VKBLOCK* b, uint32_t k, VkDeviceSize i){ b->free_bits[k][i / 64] |= 1ull << (i % 64); b->free_counts[k]++; }
+static inline void clearNode(VKBLOCK* b, uint32_t k, VkDeviceSize i){ b->free_bits[k][i / 64] &= ~(1ull << (i % 64)); b->free_counts[k]--; }
+
+//Splits the smallest free node of at least `order` down to `order`, returns its index or -1.
+static int64_t takeNode(VKBLOCK* block, uint32_t order){
+    uint32_t k = order;
+    while (k <= block->max_order && block->free_counts[k] == 0) k++;
+    if (k > block->max_order) return -1;
+
+    VkDeviceSize i = 0;
+    for (size_t w = 0;; w++) {
+        if (block->free_bits[k][w]) { i = w * 64 + __builtin_ctzll(block->free_bits[k][w]); break; }
+    }
+    clearNode(block, k, i);
+
+    for (; k > order; k--) {
+        i *= 2;
+        setNode(block, k - 1, i + 1); //Right half stays free, keep splitting the left.
+    }
+    return (int64_t)i;
+}
+
+static uint32_t orderOf(VKALLOCATOR* a, VkDeviceSize size){
+    uint32_t order = 0;
+    while ((a->min_node << order) < size) order++;
+    return order;
+}
+
+static VKBLOCK* allocateDedicated(VKCTX ctx, uint32_t memory_type, VkDeviceSize size, VkDeviceSize* offset){
+    VKALLOCATOR* a = ctx.allocator;
+    VkDeviceSize rounded = (size + a->min_node - 1) / a->min_node * a->min_node;
+    VKBLOCK* block = createBlock(ctx, memory_type, rounded, true);
+    if (!block) return NULL;
+    block->used = rounded;
+    block->allocation_count = 1;
+    *offset = 0;
+    return block;
+}
+
+//Returns NULL when the memory cannot be had within budget.
+VKBLOCK* allocateMemory(VKCTX ctx, uint32_t memory_type, VkDeviceSize size, VkDeviceSize* offset){
+    VKALLOCATOR* a = ctx.allocator;
+    if (size == 0) size = 1;
+
+    VKBLOCK* block = NULL;
+    if (size > MEMORY_BLOCK_SIZE / 2) {
+        block = allocateDedicated(ctx, memory_type, size, offset);
+    } else {
+        uint32_t order = orderOf(a, size);
+        for (int pass = 0; pass < 2 && !block; pass++) {
+            for (VKBLOCK* b = a->blocks[memory_type]; b; b = b->next) {
+                if (b->dedicated) continue;
+                int64_t node = takeNode(b, order);
+                if (node < 0) continue;
+                *offset = (VkDeviceSize)node * (a->min_node << order);
+                b->used += a->min_node << order;
+                b->allocation_count++;
+                block = b;
+                break;
+            }
+            //Close to the limit a whole new block may not fit when the buffer alone still does.
+            if (!block && pass == 0 && !createBlock(ctx, memory_type, MEMORY_BLOCK_SIZE, false)) {
+                block = allocateDedicated(ctx, memory_type, size, offset);
+                break;
+            }
+        }
+    }
+    if (block) a->requested += size;
+    return block;
+}
+
+static void unlinkBlock(VKALLOCATOR* a, VKBLOCK* block){
+    VKBLOCK** link = &a->blocks[block->memory_type];
+    while (*link != block) link = &(*link)->next;
+    *link = block->next;
+}
+
+void freeMemory(VKCTX ctx, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size){
+    VKALLOCATOR* a = ctx.allocator;
+    if (size == 0) size = 1;
+    a->requested -= size;
+    block->allocation_count--;
+
+    if (block->dedicated) {
+        unlinkBlock(a, block);
+        destroyBlock(a, ctx.device, block);
+        return;
+    }
+
+    uint32_t k = orderOf(a, size);
+    block->used -= a->min_node << k;
+    VkDeviceSize i = offset / (a->min_node << k);
+    for (; k < block->max_order && testNode(block, k, i ^ 1); k++) {
+        clearNode(block, k, i ^ 1); //Merge with the free buddy.
+        i /= 2;
+    }
+    setNode(block, k, i);
+
+    //Give empty blocks back to the driver, but keep one per type so small churn doesn't thrash.
+    if (block->allocation_count == 0) {
+        bool other = false;
+        for (VKBLOCK* b = a->blocks[block->memory_type]; b; b = b->next)
+            if (b != block && !b->dedicated) other = true;
+        if (other) {
+            unlinkBlock(a, block);
+            destroyBlock(a, ctx.device, block);
+        }
+    }
+}
+
+//Widens [offset, offset + size) of the block to whole non-coherent atoms.
+static VkMappedMemoryRange atomRange(VKALLOCATOR* a, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size){
+    VkDeviceSize start = offset / a->atom_size * a->atom_size;
+    VkDeviceSize end = (offset + size + a->atom_size - 1) / a->atom_size * a->atom_size;
+    return (VkMappedMemoryRange){
+        .sType  = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = block->memory,
+        .offset = start,
+        .size   = end >= block->size ? VK_WHOLE_SIZE : end - start,
+    };
+}
+
+//Both are no-ops on coherent memory, and on imported memory, which is never mapped through Vulkan.
+void flushMemory(VKCTX ctx, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size){
+    VKALLOCATOR* a = ctx.allocator;
+    if (block->imported || (a->props.memoryTypes[block->memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) return;
+    VkMappedMemoryRange range = atomRange(a, block, offset, size);
+    VK_CHECK(vkFlushMappedMemoryRanges(ctx.device, 1, &range));
+}
+
+void invalidateMemory(VKCTX ctx, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size){
+    VKALLOCATOR* a = ctx.allocator;
+    if (block->imported || (a->props.memoryTypes[block->memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) return;
+    VkMappedMemoryRange range = atomRange(a, block, offset, size);
+    VK_CHECK(vkInvalidateMappedMemoryRanges(ctx.device, 1, &range));
+}
+
+VKMEMORYSTATS swarmMemoryStats(VKCTX ctx){
+    VKALLOCATOR* a = ctx.allocator;
+    VKMEMORYSTATS s = {0};
+    s.requested = a->requested;
+    for (uint32_t t = 0; t < VK_MAX_MEMORY_TYPES; t++) {
+        for (VKBLOCK* block = a->blocks[t]; block; block = block->next) {
+            s.block_count++;
+            s.allocation_count += block->allocation_count;
+            s.allocated += block->allocation_size;
+            s.used += block->used;
+            if (block->dedicated) continue;
+            for (int32_t k = block->max_order; k >= 0; k--) {
+                if (block->free_counts[k] == 0) continue;
+                VkDeviceSize node = a->min_node << k;
+                if (node > s.largest_free) s.largest_free = node;
+                break;
+            }
+        }
+    }
+    VkDeviceSize free_bytes = s.allocated - s.used;
+    if (free_bytes) s.fragmentation = 1.0f - (float)s.largest_free / (float)free_bytes;
+    return s;
+}
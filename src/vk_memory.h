@@ -0,0 +1,104 @@
+#ifndef VK_MEMORY_H
+#define VK_MEMORY_H
+
+#include "vk_setup.h"
+#include <stdbool.h>
+
+#define MEMORY_BLOCK_SIZE (64ull << 20)
+#define MEMORY_MIN_NODE 256
+
+//One large allocation that buffers are carved out of with a buddy allocator.
+//Blocks only ever hold buffers, so bufferImageGranularity never applies between neighbours.
+struct VKBLOCK {
+    VkBuffer buffer; //Spans the whole block, every sub-allocation shares it.
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize allocation_size; //Bytes actually taken from the heap, can exceed size by the driver's alignment.
+    void* mapped; //Persistently mapped when the memory type is host visible, else NULL.
+    uint32_t memory_type;
+    bool dedicated; //Holds a single allocation bigger than half a block.
+    bool imported; //Memory belongs to a host pointer, the block only borrows it.
+    uint32_t max_order;
+    uint64_t** free_bits; //Per order, one bit per node that is free.
+    uint32_t* free_counts;
+    VkDeviceSize used;
+    uint32_t allocation_count;
+    struct VKBLOCK* next;
+};
+
+//Storage and descriptor sets freed by destroyBuffer or replaced by growBuffer, released once both
+//timelines pass these values.
+typedef struct {
+    VKBLOCK* block; //NULL when only the sets are retired.
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    VKDESCRIPTORSET* sets;
+    uint32_t set_count;
+    uint64_t compute_value;
+    uint64_t transfer_value;
+} RetiredMemory;
+
+struct VKALLOCATOR {
+    VkPhysicalDevice physical_device;
+    bool memory_budget; //VK_EXT_memory_budget is enabled.
+    VkPhysicalDeviceMemoryProperties props;
+    uint32_t type_bits; //Memory types a block buffer can be bound to.
+    uint32_t shared_type; //Device-local, host-visible type on the main device heap, UINT32_MAX if none.
+    VkDeviceSize min_node; //Smallest buddy node, covers every offset alignment a buffer binding needs.
+    VkDeviceSize atom_size; //nonCoherentAtomSize, granularity of flushes and invalidates.
+    VkDeviceSize storage_alignment; //minStorageBufferOffsetAlignment, buffer views must start on it.
+    VkDeviceSize import_alignment; //minImportedHostPointerAlignment, 0 without VK_EXT_external_memory_host.
+    PFN_vkGetMemoryHostPointerPropertiesEXT get_host_pointer_properties;
+    uint32_t families[2];
+    uint32_t family_count;
+    VKBLOCK* blocks[VK_MAX_MEMORY_TYPES];
+    VkDeviceSize requested;
+    VkDeviceSize heap_allocated[VK_MAX_MEMORY_HEAPS]; //Held by this context's blocks.
+    VkDeviceSize heap_limit[VK_MAX_MEMORY_HEAPS]; //Soft limit, 0 for none.
+    RetiredMemory* retired;
+    uint32_t retired_count;
+    uint32_t retired_capacity;
+};
+
+//Usage of every block buffer, sub-allocations can be bound as anything the library uses.
+#define MEMORY_BLOCK_USAGE (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT \
+                          | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT \
+                          | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT \
+                          | VK_BUFFER_USAGE_TRANSFER_SRC_BIT \
+                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+
+//Memory handed out by the allocator, summed over every memory type.
+typedef struct {
+    uint32_t block_count;
+    uint32_t allocation_count;
+    VkDeviceSize allocated; //Device memory held by blocks.
+    VkDeviceSize used;      //Bytes covered by buddy nodes in use.
+    VkDeviceSize requested; //Bytes asked for by newBuffer, used minus this is lost to rounding.
+    VkDeviceSize largest_free;
+    float fragmentation; //1 - largest_free / free, 0 when all free memory is one node.
+} VKMEMORYSTATS;
+
+//Memory of one heap, a new block is refused when it would exceed the limit or the budget.
+typedef struct {
+    VkDeviceSize size;
+    bool device_local;
+    VkDeviceSize budget;    //From VK_EXT_memory_budget, else an estimate of 80% of the heap.
+    VkDeviceSize usage;     //By the whole process from VK_EXT_memory_budget, else allocated.
+    VkDeviceSize allocated; //By this context.
+    VkDeviceSize limit;     //Set with swarmSetMemoryLimit, 0 for none.
+} VKHEAPBUDGET;
+
+VKALLOCATOR* createAllocator(VkDevice device, VkPhysicalDevice phys, uint32_t compute_family, uint32_t transfer_family, bool memory_budget, bool host_import);
+void destroyAllocator(VkDevice device, VKALLOCATOR* a);
+uint32_t findMemoryType(VKCTX ctx, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VkMemoryPropertyFlags avoided);
+VKBLOCK* allocateMemory(VKCTX ctx, uint32_t memory_type, VkDeviceSize size, VkDeviceSize* offset);
+void freeMemory(VKCTX ctx, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size);
+void retireMemory(VKCTX ctx, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size, VKDESCRIPTORSET* sets, uint32_t set_count);
+void releaseRetired(VKCTX ctx);
+VKBLOCK* importHostMemory(VKCTX ctx, void* ptr, VkDeviceSize size);
+void flushMemory(VKCTX ctx, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size);
+void invalidateMemory(VKCTX ctx, VKBLOCK* block, VkDeviceSize offset, VkDeviceSize size);
+VKMEMORYSTATS swarmMemoryStats(VKCTX ctx);
+uint32_t swarmGetMemoryBudget(VKCTX ctx, VKHEAPBUDGET heaps[VK_MAX_MEMORY_HEAPS]);
+void swarmSetMemoryLimit(VKCTX ctx, uint32_t heap, VkDeviceSize limit);
+#endif
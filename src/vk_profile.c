@@ -0,0 +1,178 @@
+#include "vk_profile.h"
+
+#define NO_QUERY UINT32_MAX
+
+VKPROFILER* createProfiler(VkPhysicalDevice phys, uint32_t compute_family, uint32_t transfer_family){
+    VKPROFILER* p = XMALLOC(sizeof(VKPROFILER));
+    memset(p, 0, sizeof(VKPROFILER));
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(phys, &props);
+    p->period = props.limits.timestampPeriod;
+
+    uint32_t qCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(phys, &qCount, NULL);
+    VkQueueFamilyProperties *families = XMALLOC(sizeof(*families) * qCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(phys, &qCount, families);
+    p->valid_bits[PROFILE_COMPUTE] = families[compute_family].timestampValidBits;
+    p->valid_bits[PROFILE_TRANSFER] = families[transfer_family].timestampValidBits;
+    free(families);
+    return p;
+}
+
+void destroyProfiler(VkDevice device, VKPROFILER* p){
+    if (p->pool != VK_NULL_HANDLE) vkDestroyQueryPool(device, p->pool, NULL);
+    for (uint32_t i = 0; i < p->event_count; ++i) free(p->events[i].name);
+    for (uint32_t i = 0; i < p->pending_count; ++i) free(p->pending[i].name);
+    free(p->pending);
+    free(p->events);
+    free(p);
+}
+
+void swarmEnableProfiling(VKCTX ctx, bool enabled){
+    VKPROFILER* p = ctx.profiler;
+    if (enabled && p->pool == VK_NULL_HANDLE) {
+        VkQueryPoolCreateInfo info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = PROFILE_QUERY_COUNT,
+        };
+        VK_CHECK(vkCreateQueryPool(ctx.device, &info, NULL, &p->pool));
+        vkResetQueryPool(ctx.device, p->pool, 0, PROFILE_QUERY_COUNT);
+    }
+    p->enabled = enabled;
+}
+
+uint32_t profileBegin(VKCTX ctx, VkCommandBuffer cmd, uint32_t queue, const char* name){
+    VKPROFILER* p = ctx.profiler;
+    if (!p->enabled || p->valid_bits[queue] == 0) return NO_QUERY;
+
+    //Pairs are freed in completion order, so scanning from the last one finds a free pair quickly.
+    uint32_t pairs = PROFILE_QUERY_COUNT / 2;
+    uint32_t pair = NO_QUERY;
+    for (uint32_t i = 0; i < pairs; ++i) {
+        uint32_t candidate = (p->next_pair + i) % pairs;
+        if (!p->used[candidate]) { pair = candidate; break; }
+    }
+    if (pair == NO_QUERY) return NO_QUERY; //Every query is in flight, skip this one.
+    p->used[pair] = true;
+    p->next_pair = (pair + 1) % pairs;
+
+    if (p->pending_count == p->pending_capacity) {
+        p->pending_capacity = p->pending_capacity ? p->pending_capacity * 2 : 64;
+        XREALLOC(p->pending, p->pending_capacity * sizeof(PendingQuery));
+    }
+    char* copy = XMALLOC(strlen(name) + 1);
+    strcpy(copy, name);
+    p->pending[p->pending_count++] = (PendingQuery){ .name = copy, .queue = queue, .query = pair * 2 };
+
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, p->pool, pair * 2);
+    return pair * 2;
+}
+
+void profileEnd(VKCTX ctx, VkCommandBuffer cmd, uint32_t query){
+    if (query == NO_QUERY) return;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, ctx.profiler->pool, query + 1);
+}
+
+//Ties every query recorded since the last submission to the ticket that completes it.
+void profileSubmitted(VKCTX ctx, VKTICKET ticket){
+    VKPROFILER* p = ctx.profiler;
+    for (uint32_t i = 0; i < p->pending_count; ++i) {
+        if (p->pending[i].semaphore == VK_NULL_HANDLE) {
+            p->pending[i].semaphore = ticket.semaphore;
+            p->pending[i].value = ticket.value;
+        }
+    }
+}
+
+//Reads back the timestamps of retired submissions into the event table.
+void profileResolve(VKCTX ctx){
+    VKPROFILER* p = ctx.profiler;
+    if (p->pending_count == 0) return;
+
+    uint64_t done[2];
+    VkSemaphore semaphores[2] = { ctx.timeline->semaphore, ctx.transfer_timeline->semaphore };
+    VK_CHECK(vkGetSemaphoreCounterValue(ctx.device, semaphores[0], &done[0]));
+    VK_CHECK(vkGetSemaphoreCounterValue(ctx.device, semaphores[1], &done[1]));
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < p->pending_count; ++i) {
+        PendingQuery q = p->pending[i];
+        uint64_t reached = q.semaphore == semaphores[0] ? done[0] : done[1];
+        if (q.semaphore == VK_NULL_HANDLE || q.value > reached) {
+            p->pending[kept++] = q;
+            continue;
+        }
+
+        uint64_t ticks[2];
+        VK_CHECK(vkGetQueryPoolResults(ctx.device, p->pool, q.query, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+        uint64_t mask = p->valid_bits[q.queue] >= 64 ? UINT64_MAX : (1ull << p->valid_bits[q.queue]) - 1;
+
+        if (p->event_count == p->event_capacity) {
+            p->event_capacity = p->event_capacity ? p->event_capacity * 2 : 256;
+            XREALLOC(p->events, p->event_capacity * sizeof(VKPROFILEEVENT));
+        }
+        p->events[p->event_count++] = (VKPROFILEEVENT){
+            .name = q.name,
+            .queue = q.queue,
+            .start_ns = (uint64_t)((ticks[0] & mask) * p->period),
+            .end_ns = (uint64_t)((ticks[1] & mask) * p->period),
+        };
+
+        vkResetQueryPool(ctx.device, p->pool, q.query, 2);
+        p->used[q.query / 2] = false;
+    }
+    p->pending_count = kept;
+}
+
+const VKPROFILEEVENT* swarmGetProfile(VKCTX ctx, uint32_t* event_count){
+    profileResolve(ctx);
+    *event_count = ctx.profiler->event_count;
+    return ctx.profiler->events;
+}
+
+void swarmClearProfile(VKCTX ctx){
+    VKPROFILER* p = ctx.profiler;
+    for (uint32_t i = 0; i < p->event_count; ++i) free(p->events[i].name);
+    p->event_count = 0;
+}
+
+static void writeJsonString(FILE* f, const char* s){
+    fputc('"', f);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+//Chrome/Perfetto trace format, one track per queue, times relative to the earliest event.
+void swarmWriteTrace(VKCTX ctx, const char* path){
+    uint32_t count;
+    const VKPROFILEEVENT* events = swarmGetProfile(ctx, &count);
+
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        printf("Could not open path: %s\n", path);
+        return;
+    }
+
+    uint64_t origin = UINT64_MAX;
+    for (uint32_t i = 0; i < count; ++i)
+        if (events[i].start_ns < origin) origin = events[i].start_ns;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"compute\"}},\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"transfer\"}}");
+    for (uint32_t i = 0; i < count; ++i) {
+        fprintf(f, ",\n{\"name\":");
+        writeJsonString(f, events[i].name);
+        fprintf(f, ",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                events[i].queue,
+                (events[i].start_ns - origin) / 1000.0,
+                (events[i].end_ns - events[i].start_ns) / 1000.0);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
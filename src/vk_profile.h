@@ -0,0 +1,56 @@
+#ifndef VK_PROFILE_H
+#define VK_PROFILE_H
+
+#include "vk_setup.h"
+#include <stdbool.h>
+
+#define PROFILE_QUERY_COUNT 4096
+#define PROFILE_COMPUTE 0
+#define PROFILE_TRANSFER 1
+
+//One timed dispatch or copy, in nanoseconds of the device clock.
+typedef struct {
+    char* name;     //Shader path of the program, or "copy".
+    uint32_t queue; //PROFILE_COMPUTE or PROFILE_TRANSFER.
+    uint64_t start_ns;
+    uint64_t end_ns;
+} VKPROFILEEVENT;
+
+//A start/end timestamp pair waiting for its submission to retire.
+typedef struct {
+    char* name;
+    uint32_t queue;
+    uint32_t query;
+    VkSemaphore semaphore; //VK_NULL_HANDLE until the command buffer is submitted.
+    uint64_t value;
+} PendingQuery;
+
+struct VKPROFILER {
+    bool enabled;
+    VkQueryPool pool;
+    bool used[PROFILE_QUERY_COUNT / 2];
+    uint32_t next_pair;
+    double period; //Nanoseconds per tick.
+    uint32_t valid_bits[2];
+    PendingQuery* pending;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    VKPROFILEEVENT* events;
+    uint32_t event_count;
+    uint32_t event_capacity;
+};
+
+VKPROFILER* createProfiler(VkPhysicalDevice phys, uint32_t compute_family, uint32_t transfer_family);
+void destroyProfiler(VkDevice device, VKPROFILER* profiler);
+
+//Recording hooks, a no-op when profiling is off or the queue has no timestamp support.
+uint32_t profileBegin(VKCTX ctx, VkCommandBuffer cmd, uint32_t queue, const char* name);
+void profileEnd(VKCTX ctx, VkCommandBuffer cmd, uint32_t query);
+void profileSubmitted(VKCTX ctx, VKTICKET ticket);
+void profileResolve(VKCTX ctx);
+
+void swarmEnableProfiling(VKCTX ctx, bool enabled);
+const VKPROFILEEVENT* swarmGetProfile(VKCTX ctx, uint32_t* event_count);
+void swarmClearProfile(VKCTX ctx);
+void swarmWriteTrace(VKCTX ctx, const char* path);
+#endif
@@ -1,4 +1,8 @@
 #include "vk_program.h"
+#include "vk_cache.h"
+#include "vk_tune.h"
+#include <pthread.h>
+#include <unistd.h>
 #include "include/hashmap.h"
 #include "include/spirv_reflect.h"
 
@@ -25,11 +29,18 @@ VkDescriptorSetLayout getDescriptorSetLayout(VKCTX ctx, VKPROGRAM* program, Shad
     return layout;
 }
 
-VkPipelineLayout getPipelineLayout(VKCTX ctx, VkDescriptorSetLayout setLayout){
+VkPipelineLayout getPipelineLayout(VKCTX ctx, VkDescriptorSetLayout setLayout, uint32_t push_constant_size){
+    VkPushConstantRange range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset     = 0,
+        .size       = push_constant_size,
+    };
     VkPipelineLayoutCreateInfo ci = {
-        .sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts    = &setLayout,
+        .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount         = 1,
+        .pSetLayouts            = &setLayout,
+        .pushConstantRangeCount = push_constant_size ? 1 : 0,
+        .pPushConstantRanges    = &range,
     };
     VkPipelineLayout plo;
     VK_CHECK(vkCreatePipelineLayout(ctx.device, &ci, NULL, &plo));
@@ -40,20 +51,95 @@ static inline uint32_t word(const uint32_t* p, size_t off) { return p[off]; }
 static inline uint32_t opcode(const uint32_t* p, size_t off) { return p[off] & 0xFFFFu; }
 static inline uint32_t length(const uint32_t* p, size_t off) { return p[off] >> 16; }
 
-ShaderInfo readShader(VKPROGRAM* program, const char* shader_path){
-    ShaderInfo s = {0};
+//First instruction from `from` with this opcode whose word at `at` is id, or 0.
+static size_t findInstruction(const uint32_t* code, size_t words, size_t from, uint32_t op, size_t at, uint32_t id){
+    for (size_t off = from; off < words && length(code, off); off += length(code, off))
+        if (opcode(code, off) == op && length(code, off) > at && word(code, off + at) == id) return off;
+    return 0;
+}
 
-    FILE* f = fopen(shader_path, "rb");
-    if (!f) {
-        printf("Could not open path: %s\n", shader_path);
-        exit(0);
+//Value of a scalar constant id, taken from the specialization data when it has a SpecId.
+static uint32_t constantValue(const uint32_t* code, size_t words, const ShaderInfo* s, uint32_t id, uint32_t* spec_id){
+    *spec_id = UINT32_MAX;
+    for (size_t off = 5; (off = findInstruction(code, words, off, SpvOpDecorate, 1, id)); off += length(code, off)) {
+        if (word(code, off + 2) != SpvDecorationSpecId) continue;
+        *spec_id = word(code, off + 3);
+        for (uint32_t i = 0; i < s->spec_count; ++i) {
+            if (s->spec_entries[i].constantID != *spec_id) continue;
+            uint32_t v;
+            memcpy(&v, s->spec_data + s->spec_entries[i].offset, sizeof(v));
+            return v;
+        }
+    }
+    size_t off = findInstruction(code, words, 5, SpvOpConstant, 2, id);
+    if (!off) off = findInstruction(code, words, 5, SpvOpSpecConstant, 2, id);
+    return off ? word(code, off + 3) : 1;
+}
+
+//Reflection only knows literal LocalSize. With local_size_x_id the size comes from the WorkgroupSize
+//built-in or a LocalSizeId execution mode instead, either of which may name specialization constants.
+static void specializedLocalSize(const uint32_t* code, size_t words, const ShaderInfo* s, VKPROGRAM* program){
+    const uint32_t* ids = NULL;
+    size_t off = 5;
+    for (; (off = findInstruction(code, words, off, SpvOpDecorate, 2, SpvDecorationBuiltIn)); off += length(code, off)) {
+        if (word(code, off + 3) != SpvBuiltInWorkgroupSize) continue;
+        size_t composite = findInstruction(code, words, 5, SpvOpSpecConstantComposite, 2, word(code, off + 1));
+        if (!composite) composite = findInstruction(code, words, 5, SpvOpConstantComposite, 2, word(code, off + 1));
+        if (composite && length(code, composite) >= 6) ids = &code[composite + 3];
+        break;
+    }
+    if (!ids && (off = findInstruction(code, words, 5, SpvOpExecutionModeId, 2, SpvExecutionModeLocalSizeId)))
+        ids = &code[off + 3];
+    if (!ids) return;
+    for (int d = 0; d < 3; ++d)
+        program->local_size[d] = constantValue(code, words, s, ids[d], &program->local_size_ids[d]);
+}
+
+//Lays out every specialization constant of the module with its default value, then applies the
+//caller's values on top. Unknown names or ids are an error, a typo would silently do nothing.
+static void specialize(ShaderInfo* s, SpvReflectShaderModule* mod, const char* shader_path, const VKSPECIALIZATION* constants, uint32_t constant_count){
+    s->spec_count = mod->spec_constant_count;
+    if (s->spec_count == 0) {
+        if (constant_count) {
+            printf("%s has no specialization constants\n", shader_path);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    s->spec_entries = XMALLOC(s->spec_count * sizeof(VkSpecializationMapEntry));
+    s->spec_data = XMALLOC(s->spec_count * sizeof(uint64_t));
+    s->spec_size = 0;
+    for (uint32_t i = 0; i < s->spec_count; ++i) {
+        SpvReflectSpecializationConstant* c = &mod->spec_constants[i];
+        s->spec_entries[i] = (VkSpecializationMapEntry){
+            .constantID = c->constant_id,
+            .offset = s->spec_size,
+            .size = c->default_value_size
+        };
+        memcpy(s->spec_data + s->spec_size, c->default_value, c->default_value_size);
+        s->spec_size += c->default_value_size;
     }
-    fseek(f, 0, SEEK_END);
-    size_t code_size = ftell(f);
-    rewind(f);
-    uint32_t* code = (uint32_t*)XMALLOC(code_size);
-    fread(code, 1, code_size, f);
-    fclose(f);
+
+    for (uint32_t j = 0; j < constant_count; ++j) {
+        uint32_t i = 0;
+        for (; i < s->spec_count; ++i) {
+            const char* name = mod->spec_constants[i].name;
+            if (constants[j].name ? name && strcmp(name, constants[j].name) == 0 : s->spec_entries[i].constantID == constants[j].id) break;
+        }
+        if (i == s->spec_count) {
+            if (constants[j].name) printf("%s has no specialization constant %s\n", shader_path, constants[j].name);
+            else printf("%s has no specialization constant with id %u\n", shader_path, constants[j].id);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(s->spec_data + s->spec_entries[i].offset, &constants[j].value, s->spec_entries[i].size);
+    }
+}
+
+//Reflects the program's SPIR-V, which must already be in program->spirv.
+ShaderInfo reflectShader(VKPROGRAM* program, const char* shader_path, const VKSPECIALIZATION* constants, uint32_t constant_count){
+    ShaderInfo s = {0};
+    const uint32_t* code = program->spirv;
+    size_t code_size = program->spirv_size;
 
     SpvReflectShaderModule mod;
     SpvReflectResult res = spvReflectCreateShaderModule(code_size, code, &mod);
@@ -68,6 +154,15 @@ ShaderInfo readShader(VKPROGRAM* program, const char* shader_path){
     spvReflectEnumerateDescriptorBindings(&mod, &count, binds);;
 
     program->buffer_count = count;
+    program->local_size[0] = program->local_size[1] = program->local_size[2] = 1;
+    if (mod.entry_point_count > 0) {
+        program->local_size[0] = mod.entry_points[0].local_size.x ? mod.entry_points[0].local_size.x : 1;
+        program->local_size[1] = mod.entry_points[0].local_size.y ? mod.entry_points[0].local_size.y : 1;
+        program->local_size[2] = mod.entry_points[0].local_size.z ? mod.entry_points[0].local_size.z : 1;
+    }
+    program->local_size_ids[0] = program->local_size_ids[1] = program->local_size_ids[2] = UINT32_MAX;
+    specialize(&s, &mod, shader_path, constants, constant_count);
+    specializedLocalSize(code, code_size / sizeof(uint32_t), &s, program);
     if(!(mod.entry_point_name) || strlen(mod.entry_point_name) == 1){
         s.entrypoint = "main";
     } else {
@@ -75,8 +170,7 @@ ShaderInfo readShader(VKPROGRAM* program, const char* shader_path){
         strcpy(s.entrypoint, mod.entry_point_name);
     }
 
-    s.spirv_bytecode = XMALLOC(code_size);
-    memcpy(s.spirv_bytecode, code, code_size);
+    s.spirv_bytecode = program->spirv;
     s.spirv_bytecode_length = code_size;
     for (uint32_t i = 0; i < count; ++i) {
         program->buffer_indices[i] = binds[i]->binding;
@@ -104,46 +198,146 @@ ShaderInfo readShader(VKPROGRAM* program, const char* shader_path){
         }
     }
 
+    /* push constants, one range from 0 to the end of the furthest member */
+    uint32_t pc_count = 0;
+    spvReflectEnumeratePushConstantBlocks(&mod, &pc_count, NULL);
+    SpvReflectBlockVariable** blocks = XMALLOC((pc_count ? pc_count : 1) * sizeof *blocks);
+    spvReflectEnumeratePushConstantBlocks(&mod, &pc_count, blocks);
+    program->push_constant_size = 0;
+    for (uint32_t i = 0; i < pc_count; ++i) {
+        //A block's size already counts from offset 0, its members carry their own offsets.
+        uint32_t end = blocks[i]->member_count ? 0 : blocks[i]->size;
+        for (uint32_t m = 0; m < blocks[i]->member_count; ++m) {
+            uint32_t member_end = blocks[i]->members[m].offset + blocks[i]->members[m].size;
+            if (member_end > end) end = member_end;
+        }
+        if (end > program->push_constant_size) program->push_constant_size = end;
+    }
+    if (program->push_constant_size > MAX_PUSH_CONSTANT_SIZE) {
+        printf("Push constants of %s exceed %d bytes\n", shader_path, MAX_PUSH_CONSTANT_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    free(blocks);
+    free(binds);
+
     spvReflectDestroyShaderModule(&mod);
     return s;
 }
 
-VkPipeline createPipeline(VKCTX ctx, VkPipelineLayout pipelineLayout, ShaderInfo shader_info){
+//A program on its way from SPIR-V to a pipeline. Everything up to the pipeline itself is built
+//per job, so jobs can be prepared on separate threads and their pipelines created in one call.
+typedef struct {
+    const char* name;
+    const uint32_t* code;
+    size_t code_size;
+    VKSPECIALIZATION* constants; //Caller's constants plus the tuned ones.
+    uint32_t constant_count;
+    uint64_t hash;
+    char* key;
+    uint32_t key_len;
+    int32_t same_as; //Index of an earlier job with the same key, -1 if none.
+    VKPROGRAM* program;
+    ShaderInfo info;
+    VkShaderModule module;
+    VkSpecializationInfo spec;
+    VkPipelineCreationFeedbackEXT feedback;
+    VkPipelineCreationFeedbackCreateInfoEXT feedback_info;
+} PipelineJob;
+
+//Reflection, layouts and the shader module. Touches no shared state, safe to run concurrently.
+static void prepareJob(VKCTX ctx, PipelineJob* job){
+    VKPROGRAM* program = XMALLOC(sizeof(VKPROGRAM));
+    memset(program, 0, sizeof(VKPROGRAM));
+    char* name_copy = XMALLOC(strlen(job->name) + 1);
+    strcpy(name_copy, job->name);
+    program->shader_path = name_copy;
+    program->shader_hash = job->hash;
+    program->spirv = XMALLOC(job->code_size);
+    memcpy(program->spirv, job->code, job->code_size);
+    program->spirv_size = job->code_size;
+    job->program = program;
+
+    job->info = reflectShader(program, job->name, job->constants, job->constant_count);
+    program->descriptor_set_layout = getDescriptorSetLayout(ctx, program, job->info);
+    program->pipeline_layout = getPipelineLayout(ctx, program->descriptor_set_layout, program->push_constant_size);
+
     VkShaderModuleCreateInfo smi = {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = shader_info.spirv_bytecode_length,
-        .pCode = shader_info.spirv_bytecode,
+        .codeSize = job->info.spirv_bytecode_length,
+        .pCode = job->info.spirv_bytecode,
     };
-
-    VkShaderModule shader;
-    VK_CHECK(vkCreateShaderModule(ctx.device, &smi, NULL, &shader));    
-    VkPipelineShaderStageCreateInfo stage = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
-        .module = shader,
-        .pName = shader_info.entrypoint
+    VK_CHECK(vkCreateShaderModule(ctx.device, &smi, NULL, &job->module));
+    job->spec = (VkSpecializationInfo){
+        .mapEntryCount = job->info.spec_count,
+        .pMapEntries = job->info.spec_entries,
+        .dataSize = job->info.spec_size,
+        .pData = job->info.spec_data
     };
-
-    VkComputePipelineCreateInfo pci = {
-        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-        .stage = stage,
-        .layout = pipelineLayout
+    job->feedback_info = (VkPipelineCreationFeedbackCreateInfoEXT){
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT,
+        .pPipelineCreationFeedback = &job->feedback,
+        .pipelineStageCreationFeedbackCount = 0
     };
+}
 
-    VkPipeline pipeline;
-    VK_CHECK(vkCreateComputePipelines(ctx.device, VK_NULL_HANDLE, 1, &pci, NULL, &pipeline));
+//One vkCreateComputePipelines for every prepared job, the driver may compile them in parallel.
+static void createPipelines(VKCTX ctx, PipelineJob** jobs, uint32_t count){
+    VkComputePipelineCreateInfo* infos = XMALLOC(count * sizeof(VkComputePipelineCreateInfo));
+    VkPipeline* pipelines = XMALLOC(count * sizeof(VkPipeline));
+    for (uint32_t i = 0; i < count; ++i) {
+        PipelineJob* job = jobs[i];
+        infos[i] = (VkComputePipelineCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .pNext = ctx.pipeline_cache->feedback ? &job->feedback_info : NULL,
+            .stage = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = job->module,
+                .pName = job->info.entrypoint,
+                .pSpecializationInfo = &job->spec
+            },
+            .layout = job->program->pipeline_layout
+        };
+    }
+    VK_CHECK(vkCreateComputePipelines(ctx.device, ctx.pipeline_cache->cache, count, infos, NULL, pipelines));
 
-    vkDestroyShaderModule(ctx.device, shader, NULL);
-    free(shader_info.spirv_bytecode);
-    shader_info.spirv_bytecode_length = 0;
-    return pipeline;
+    for (uint32_t i = 0; i < count; ++i) {
+        PipelineJob* job = jobs[i];
+        job->program->pipeline = pipelines[i];
+        reportPipelineFeedback(ctx.pipeline_cache, job->name, &job->feedback);
+        vkDestroyShaderModule(ctx.device, job->module, NULL);
+        free(job->info.spec_entries);
+        free(job->info.spec_data);
+    }
+    free(pipelines);
+    free(infos);
 }
 
 static struct hashmap_s program_map;
 static int program_map_initialized = 0;
 
-VKPROGRAM createProgram(VKCTX ctx, const char* shader_path){
-    printf("Shader path: %s\n", shader_path);
+//Cache key of a variant: the content hash, then the module's resolved specialization data in hex.
+//Constants given by name or by id, in any order, or set to their defaults produce the same bytes.
+static char* programKey(const PipelineJob* job, uint32_t* key_len){
+    SpvReflectShaderModule mod;
+    if (spvReflectCreateShaderModule(job->code_size, job->code, &mod) != SPV_REFLECT_RESULT_SUCCESS) {
+        printf("SPIRV-Reflect failed for %s\n", job->name);
+        exit(EXIT_FAILURE);
+    }
+    ShaderInfo s = {0};
+    specialize(&s, &mod, job->name, job->constants, job->constant_count);
+    spvReflectDestroyShaderModule(&mod);
+
+    char* key = XMALLOC(17 + 2 * s.spec_size);
+    size_t n = sprintf(key, "%016llx", (unsigned long long)job->hash);
+    for (size_t i = 0; i < s.spec_size; ++i) n += sprintf(key + n, "%02x", s.spec_data[i]);
+    free(s.spec_entries);
+    free(s.spec_data);
+    *key_len = n;
+    return key;
+}
+
+static void initProgramMap(void){
     if (!program_map_initialized) {
         if (0 != hashmap_create(1, &program_map)) {
             printf("Error creating hashmap for program cache.\n");
@@ -151,21 +345,198 @@ VKPROGRAM createProgram(VKCTX ctx, const char* shader_path){
         }
         program_map_initialized = 1;
     }
-    VKPROGRAM* cached = hashmap_get(&program_map, shader_path, strlen(shader_path));
-    if (cached) return *cached;
+}
 
-    VKPROGRAM* program = XMALLOC(sizeof(VKPROGRAM));
-    ShaderInfo shader_info = readShader(program, shader_path);
-    program->descriptor_set_layout = getDescriptorSetLayout(ctx, program, shader_info);
-    program->pipeline_layout = getPipelineLayout(ctx, program->descriptor_set_layout);
-    program->pipeline = createPipeline(ctx, program->pipeline_layout, shader_info);
-    hashmap_put(&program_map, shader_path, strlen(shader_path), program);
-    return *program;
+//Hash, tuning and cache key of a job. Returns the cached program, or NULL when it must be built.
+static VKPROGRAM* lookupJob(VKCTX ctx, PipelineJob* job, const VKSPECIALIZATION* constants, uint32_t constant_count){
+    job->hash = swarmFnv1a(job->code, job->code_size);
+    job->constant_count = constant_count;
+    job->constants = applyTuning(ctx, job->hash, constants, &job->constant_count);
+    if (job->constants == constants) {
+        job->constants = XMALLOC((constant_count ? constant_count : 1) * sizeof(VKSPECIALIZATION));
+        if (constant_count) memcpy(job->constants, constants, constant_count * sizeof(VKSPECIALIZATION));
+    }
+    job->key = programKey(job, &job->key_len);
+    job->same_as = -1;
+    return hashmap_get(&program_map, job->key, job->key_len);
+}
+
+//Puts a built program in the cache, which takes the key.
+static void finishJob(PipelineJob* job){
+    hashmap_put(&program_map, job->key, job->key_len, job->program);
+    job->key = NULL;
+}
+
+//Programs are cached by SPIR-V content, so the same module loaded from two paths or from memory
+//shares its pipelines. A shared program keeps the name it was first created with. *created, when
+//given, tells whether this call built the program rather than finding it in the cache.
+static VKPROGRAM createVariant(VKCTX ctx, const char* name, const uint32_t* code, size_t code_size, const VKSPECIALIZATION* constants, uint32_t constant_count, bool* created){
+    initProgramMap();
+    PipelineJob job = { .name = name, .code = code, .code_size = code_size };
+    VKPROGRAM* cached = lookupJob(ctx, &job, constants, constant_count);
+    if (created) *created = cached == NULL;
+    if (!cached) {
+        PipelineJob* jobs = &job;
+        prepareJob(ctx, &job);
+        createPipelines(ctx, &jobs, 1);
+        finishJob(&job);
+        cached = job.program;
+    }
+    free(job.constants);
+    free(job.key);
+    return *cached;
+}
+
+//"dir/add.spv" -> "add", the name embed_shaders.sh gives the module.
+static const VKEMBEDDEDSHADER* embeddedShaderFor(const char* shader_path){
+    const char* base = strrchr(shader_path, '/');
+    base = base ? base + 1 : shader_path;
+    size_t len = strlen(base);
+    if (len > 4 && !strcmp(base + len - 4, ".spv")) len -= 4;
+    for (uint32_t i = 0; i < swarm_embedded_shader_count; ++i)
+        if (strlen(swarm_embedded_shaders[i].name) == len && !strncmp(swarm_embedded_shaders[i].name, base, len))
+            return &swarm_embedded_shaders[i];
+    return NULL;
+}
+
+//SPIR-V of the file, or of the embedded shader with the same name when the file cannot be opened,
+//so deployments without the shader directory still work. *owned tells the caller to free it.
+static const uint32_t* loadShader(const char* shader_path, size_t* size, bool* owned){
+    void* code;
+    if (swarmReadFile(shader_path, &code, size)) {
+        *owned = true;
+        return code;
+    }
+    const VKEMBEDDEDSHADER* embedded = embeddedShaderFor(shader_path);
+    if (!embedded) {
+        printf("Could not open path: %s\n", shader_path);
+        exit(0);
+    }
+    *owned = false;
+    *size = embedded->size;
+    return embedded->words;
+}
+
+VKPROGRAM createProgramSpecialized(VKCTX ctx, const char* shader_path, const VKSPECIALIZATION* constants, uint32_t constant_count){
+    printf("Shader path: %s\n", shader_path);
+    size_t code_size;
+    bool owned;
+    const uint32_t* code = loadShader(shader_path, &code_size, &owned);
+    VKPROGRAM program = createVariant(ctx, shader_path, code, code_size, constants, constant_count, NULL);
+    if (owned) free((void*)code);
+    return program;
+}
+
+VKPROGRAM createProgram(VKCTX ctx, const char* shader_path){
+    return createProgramSpecialized(ctx, shader_path, NULL, 0);
+}
+
+typedef struct {
+    VKCTX ctx;
+    PipelineJob** jobs;
+    uint32_t count;
+    uint32_t next; //Next job to claim, taken with an atomic add.
+} PrepareQueue;
+
+static void* prepareWorker(void* arg){
+    PrepareQueue* q = arg;
+    for (uint32_t i; (i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < q->count; )
+        prepareJob(q->ctx, q->jobs[i]);
+    return NULL;
+}
+
+//Files are read and looked up in order, then the missing programs are reflected on one thread per
+//core and all their pipelines are created with a single vkCreateComputePipelines.
+void createPrograms(VKCTX ctx, const char** shader_paths, uint32_t count, VKPROGRAM* programs){
+    if (count == 0) return;
+    initProgramMap();
+    PipelineJob* jobs = XMALLOC(count * sizeof(PipelineJob));
+    PipelineJob** pending = XMALLOC(count * sizeof(PipelineJob*));
+    bool* owned = XMALLOC(count * sizeof(bool));
+    uint32_t pending_count = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        printf("Shader path: %s\n", shader_paths[i]);
+        jobs[i] = (PipelineJob){ .name = shader_paths[i] };
+        jobs[i].code = loadShader(shader_paths[i], &jobs[i].code_size, &owned[i]);
+        jobs[i].program = lookupJob(ctx, &jobs[i], NULL, 0);
+        if (jobs[i].program) continue;
+        for (uint32_t k = 0; k < i; ++k) { //The same module twice in one batch is built once.
+            if (jobs[k].key_len == jobs[i].key_len && !memcmp(jobs[k].key, jobs[i].key, jobs[i].key_len)) {
+                jobs[i].same_as = k;
+                break;
+            }
+        }
+        if (jobs[i].same_as < 0) pending[pending_count++] = &jobs[i];
+    }
+
+    if (pending_count) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        uint32_t thread_count = cpus > 1 ? (uint32_t)cpus : 1;
+        if (thread_count > pending_count) thread_count = pending_count;
+        PrepareQueue q = { ctx, pending, pending_count, 0 };
+        pthread_t* threads = XMALLOC(thread_count * sizeof(pthread_t));
+        uint32_t started = 0;
+        for (; started + 1 < thread_count; ++started) //The calling thread works too.
+            if (pthread_create(&threads[started], NULL, prepareWorker, &q)) break;
+        prepareWorker(&q);
+        for (uint32_t t = 0; t < started; ++t) pthread_join(threads[t], NULL);
+        free(threads);
+
+        createPipelines(ctx, pending, pending_count);
+        for (uint32_t i = 0; i < pending_count; ++i) finishJob(pending[i]);
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        VKPROGRAM* program = jobs[i].program ? jobs[i].program : jobs[jobs[i].same_as].program;
+        programs[i] = *program;
+        free(jobs[i].constants);
+        free(jobs[i].key);
+        if (owned[i]) free((void*)jobs[i].code);
+    }
+    free(owned);
+    free(pending);
+    free(jobs);
+}
+
+VKPROGRAM createProgramFromMemory(VKCTX ctx, const uint32_t* words, size_t size){
+    char name[32];
+    snprintf(name, sizeof(name), "spirv:%016llx", (unsigned long long)swarmFnv1a(words, size));
+    return createVariant(ctx, name, words, size, NULL, 0, NULL);
+}
+
+VKPROGRAM createEmbeddedProgram(VKCTX ctx, const char* name){
+    for (uint32_t i = 0; i < swarm_embedded_shader_count; ++i)
+        if (!strcmp(swarm_embedded_shaders[i].name, name))
+            return createVariant(ctx, name, swarm_embedded_shaders[i].words, swarm_embedded_shaders[i].size, NULL, 0, NULL);
+    printf("No shader named %s was embedded, run embed_shaders.sh after compile_shaders.sh\n", name);
+    exit(EXIT_FAILURE);
+}
+
+VKPROGRAM specializeProgram(VKCTX ctx, const VKPROGRAM* program, const VKSPECIALIZATION* constants, uint32_t constant_count){
+    return createVariant(ctx, program->shader_path, program->spirv, program->spirv_size, constants, constant_count, NULL);
+}
+
+VKPROGRAM findOrCreateVariant(VKCTX ctx, const VKPROGRAM* program, const VKSPECIALIZATION* constants, uint32_t constant_count, bool* created){
+    return createVariant(ctx, program->shader_path, program->spirv, program->spirv_size, constants, constant_count, created);
 }
 
 static struct hashmap_s descriptor_map;
 static int descriptor_map_initialized = 0;
 
+//What one binding of a cached set points at.
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize range;
+} DescriptorBinding;
+
+//Descriptor cache key, only the first buffer_count bindings are hashed. Views of one buffer
+//differ by offset and range, and sets of different layouts are never shared.
+typedef struct {
+    VkDescriptorSetLayout layout;
+    DescriptorBinding bindings[MAX_BUFFERS];
+} DescriptorKey;
+
 //Note: Buffers are in order of bindings so their index in the array corresponds to their binding idx.
 void useBuffers(VKCTX ctx, VKPROGRAM* program, VKBUFFER* buffers, size_t buffer_count){
     if (!descriptor_map_initialized) {
@@ -176,21 +547,26 @@ void useBuffers(VKCTX ctx, VKPROGRAM* program, VKBUFFER* buffers, size_t buffer_
         descriptor_map_initialized = 1;
     }
 
-    VkDescriptorSet* cached = hashmap_get(&descriptor_map, buffers, buffer_count * sizeof(VKBUFFER));
+    if (buffer_count > MAX_BUFFERS) {
+        fprintf(stderr, "useBuffers: %zu buffers, at most %d can be bound\n", buffer_count, MAX_BUFFERS);
+        exit(1);
+    }
+    DescriptorKey key;
+    memset(&key, 0, sizeof(key));
+    key.layout = program->descriptor_set_layout;
+    for (size_t b = 0; b < buffer_count; ++b)
+        key.bindings[b] = (DescriptorBinding){ buffers[b].buffer, buffers[b].offset, buffers[b].size };
+    uint32_t key_size = offsetof(DescriptorKey, bindings) + buffer_count * sizeof(DescriptorBinding);
+
+    VKDESCRIPTORSET* cached = hashmap_get(&descriptor_map, &key, key_size);
     if (cached) {
         memcpy(program->buffers, buffers, buffer_count * sizeof(VKBUFFER));
-        program->descriptor_set = *cached;
+        program->descriptor_set = cached->set;
         return;
     }
 
-    VkDescriptorSet* newSet = XMALLOC(sizeof(VkDescriptorSet));
-    VkDescriptorSetAllocateInfo ai = {
-        .sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool     = ctx.descriptor_pool,
-        .descriptorSetCount = 1,
-        .pSetLayouts        = &program->descriptor_set_layout
-    };
-    VK_CHECK(vkAllocateDescriptorSets(ctx.device, &ai, newSet));
+    VKDESCRIPTORSET* newSet = XMALLOC(sizeof(VKDESCRIPTORSET));
+    *newSet = allocateDescriptorSet(ctx, program->descriptor_set_layout);
 
     VkDescriptorBufferInfo infos[buffer_count];
     VkWriteDescriptorSet   writes[buffer_count];
@@ -198,12 +574,12 @@ void useBuffers(VKCTX ctx, VKPROGRAM* program, VKBUFFER* buffers, size_t buffer_
     for (b = 0; b < buffer_count; ++b) {
         infos[b] = (VkDescriptorBufferInfo){
             .buffer = buffers[b].buffer,
-            .offset = 0,
-            .range  = VK_WHOLE_SIZE
+            .offset = buffers[b].offset,
+            .range  = buffers[b].size
         };
         writes[b] = (VkWriteDescriptorSet){
             .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet          = *newSet,
+            .dstSet          = newSet->set,
             .dstBinding      = program->buffer_indices[b],
             .descriptorCount = 1,
             .descriptorType  = program->buffer_types[b],
@@ -211,29 +587,140 @@ void useBuffers(VKCTX ctx, VKPROGRAM* program, VKBUFFER* buffers, size_t buffer_
         };
     }
     vkUpdateDescriptorSets(ctx.device, buffer_count, writes, 0, NULL);
-    VKBUFFER* buffers_heap = XMALLOC(buffer_count * sizeof(VKBUFFER));
-    memcpy(buffers_heap, buffers, buffer_count * sizeof(VKBUFFER));
-    hashmap_put(&descriptor_map, buffers_heap, buffer_count * sizeof(VKBUFFER), newSet);
+    DescriptorKey* key_heap = XMALLOC(key_size);
+    memcpy(key_heap, &key, key_size);
+    hashmap_put(&descriptor_map, key_heap, key_size, newSet);
     memcpy(program->buffers, buffers, buffer_count * sizeof(VKBUFFER));
-    program->descriptor_set = *newSet;
+    program->descriptor_set = newSet->set;
 }
 
-void destroyProgram(VKCTX ctx, const char* shader_path){
-    if (!program_map_initialized) {
-        if (0 != hashmap_create(1, &program_map)) {
-            printf("Error creating hashmap for program cache.\n");
-            exit(1);
-        }
-        program_map_initialized = 1;
+typedef struct {
+    BufferRange range;
+    VKDESCRIPTORSET* sets;
+    uint32_t count;
+} ForgetContext;
+
+static int forgetIfBound(void* const context, struct hashmap_element_s* const e){
+    ForgetContext* f = context;
+    const DescriptorKey* key = e->key;
+    uint32_t binding_count = (e->key_len - offsetof(DescriptorKey, bindings)) / sizeof(DescriptorBinding);
+    for (uint32_t b = 0; b < binding_count; ++b) {
+        const DescriptorBinding* d = &key->bindings[b];
+        if (d->buffer != f->range.buffer) continue;
+        if (d->offset >= f->range.offset + f->range.size || f->range.offset >= d->offset + d->range) continue;
+        VKDESCRIPTORSET* set = e->data;
+        XREALLOC(f->sets, (f->count + 1) * sizeof(VKDESCRIPTORSET));
+        f->sets[f->count++] = *set;
+        free(set);
+        free((void*)e->key);
+        return -1; //Removes the element.
     }
+    return 0; //Keeps iterating, 1 would stop here.
+}
+
+//Drops every cached set that binds part of range, so the next useBuffers writes a new one.
+//The sets may still be in flight, they are returned for the caller to free later. Caller frees.
+VKDESCRIPTORSET* forgetDescriptorSets(BufferRange range, uint32_t* count){
+    ForgetContext f = { range, NULL, 0 };
+    if (descriptor_map_initialized) hashmap_iterate_pairs(&descriptor_map, forgetIfBound, &f);
+    *count = f.count;
+    return f.sets;
+}
+
+void setDispatchDirect(VKPROGRAM* program, uint32_t x, uint32_t y, uint32_t z){
+    program->dispatch = (VKDISPATCH){ .type = DISPATCH_DIRECT, .x = x, .y = y, .z = z };
+}
+
+void setDispatchIndirect(VKPROGRAM* program, VKBUFFER buffer, VkDeviceSize offset){
+    program->dispatch = (VKDISPATCH){ .type = DISPATCH_INDIRECT, .buffer = buffer, .offset = offset };
+}
+
+void setDispatchElements(VKPROGRAM* program, uint32_t x, uint32_t y, uint32_t z){
+    program->dispatch = (VKDISPATCH){ .type = DISPATCH_ELEMENTS, .x = x, .y = y, .z = z };
+}
 
-    VKPROGRAM* program = hashmap_get(&program_map, shader_path, strlen(shader_path));
-    if (!program) return;
+//Bytes are pushed with every dispatch of the program, so updating a scalar needs no buffer or copy.
+void setPushConstants(VKPROGRAM* program, const void* data, uint32_t offset, uint32_t size){
+    if (offset + size > program->push_constant_size) {
+        printf("Push constant write [%u, %u) is outside the program's %u bytes\n", offset, offset + size, program->push_constant_size);
+        exit(1);
+    }
+    memcpy(program->push_constants + offset, data, size);
+}
+
+typedef struct {
+    VkDescriptorSetLayout layout;
+    VKDESCRIPTORSET* sets;
+    uint32_t count;
+} LayoutForgetContext;
+
+static int forgetIfLayout(void* const context, struct hashmap_element_s* const e){
+    LayoutForgetContext* f = context;
+    const DescriptorKey* key = e->key;
+    if (key->layout != f->layout) return 0;
+    VKDESCRIPTORSET* set = e->data;
+    XREALLOC(f->sets, (f->count + 1) * sizeof(VKDESCRIPTORSET));
+    f->sets[f->count++] = *set;
+    free(set);
+    free((void*)e->key);
+    return -1; //Removes the element.
+}
+
+//Destroys a cached program and frees the sets written for its layout, whose handle a later layout
+//could otherwise reuse and hit in the descriptor cache. No submission may still use them.
+static void releaseProgram(VKCTX ctx, VKPROGRAM* program){
+    LayoutForgetContext f = { program->descriptor_set_layout, NULL, 0 };
+    if (descriptor_map_initialized) hashmap_iterate_pairs(&descriptor_map, forgetIfLayout, &f);
+    freeDescriptorSets(ctx, f.sets, f.count);
+    free(f.sets);
     vkDestroyPipeline(ctx.device, program->pipeline, NULL);
     vkDestroyPipelineLayout(ctx.device, program->pipeline_layout, NULL);
     vkDestroyDescriptorSetLayout(ctx.device, program->descriptor_set_layout, NULL);
+    free((char*)program->shader_path);
+    free(program->spirv);
     free(program);
-    hashmap_remove(&program_map, shader_path, strlen(shader_path));
+}
+
+typedef struct {
+    VKCTX ctx;
+    const char* path;
+    bool hashed;
+    uint64_t hash;
+    VkPipeline pipeline; //Only this variant when set.
+} DestroyContext;
+
+static int destroyIfVariant(void* const context, struct hashmap_element_s* const e){
+    DestroyContext* d = context;
+    VKPROGRAM* program = e->data;
+    if (d->pipeline != VK_NULL_HANDLE) {
+        if (program->pipeline != d->pipeline) return 0;
+    } else if (strcmp(program->shader_path, d->path) && !(d->hashed && program->shader_hash == d->hash)) {
+        return 0;
+    }
+    releaseProgram(d->ctx, program);
+    free((void*)e->key);
+    return -1; //Removes the element.
+}
+
+void destroyVariant(VKCTX ctx, VKPROGRAM variant){
+    if (!program_map_initialized) return;
+    DestroyContext d = { ctx, NULL, false, 0, variant.pipeline };
+    hashmap_iterate_pairs(&program_map, destroyIfVariant, &d);
+}
+
+//Variants are found by name and, when the file can be read, by content, since the cached program
+//may carry the name of another path with the same SPIR-V.
+void destroyProgram(VKCTX ctx, const char* shader_path){
+    if (!program_map_initialized) return;
+    DestroyContext d = { ctx, shader_path, false, 0, VK_NULL_HANDLE };
+    void* code;
+    size_t code_size;
+    if (swarmReadFile(shader_path, &code, &code_size)) {
+        d.hashed = true;
+        d.hash = swarmFnv1a(code, code_size);
+        free(code);
+    }
+    hashmap_iterate_pairs(&program_map, destroyIfVariant, &d);
 }
 
 #include <stdio.h>
@@ -256,11 +743,15 @@ void verifyVKPROGRAM(VKPROGRAM* prog) {
 
     printf("\n=== VKPROGRAM Verification ===\n");
     printf("Struct address: %p\n", (void*)prog);
+    printf("shader_path:           %s\n", prog->shader_path ? prog->shader_path : "(none)");
     printf("descriptor_set_layout: %p\n", (void*)prog->descriptor_set_layout);
     printf("pipeline_layout:       %p\n", (void*)prog->pipeline_layout);
     printf("pipeline:              %p\n", (void*)prog->pipeline);
     printf("descriptor_set:        %p\n", (void*)prog->descriptor_set);
     printf("buffer_count:          %zu\n", prog->buffer_count);
+    printf("local_size:            %u x %u x %u\n", prog->local_size[0], prog->local_size[1], prog->local_size[2]);
+    printf("dispatch type:         %u (0=default, 1=direct, 2=indirect, 3=elements)\n", prog->dispatch.type);
+    printf("push_constant_size:    %u\n", prog->push_constant_size);
 
     if (prog->buffer_count > MAX_BUFFERS) {
         printf("buffer_count (%zu) exceeds MAX_BUFFERS!\n", prog->buffer_count);
@@ -5,6 +5,7 @@
 #include "vk_buffer.h"
 
 #define MAX_BUFFERS 16
+#define MAX_PUSH_CONSTANT_SIZE 128 //Minimum maxPushConstantsSize every device supports.
 
 typedef enum {
     READ_ONLY,
@@ -12,7 +13,22 @@ typedef enum {
     READ_AND_WRITE
 } BindingLimitations;
 
+typedef enum {
+    DISPATCH_DEFAULT = 0, //Indirect buffer passed to runComputeCommand, offset 0.
+    DISPATCH_DIRECT,      //x, y, z work-groups.
+    DISPATCH_INDIRECT,    //VkDispatchIndirectCommand at buffer + offset.
+    DISPATCH_ELEMENTS     //x, y, z invocations, rounded up to whole work-groups of the reflected local size.
+} DispatchType;
+
+typedef struct {
+    DispatchType type;
+    uint32_t x, y, z;
+    VKBUFFER buffer;
+    VkDeviceSize offset;
+} VKDISPATCH;
+
 typedef struct{
+    const char* shader_path;
     VkDescriptorSetLayout descriptor_set_layout;
     VkPipelineLayout pipeline_layout;
     VkPipeline pipeline;
@@ -22,16 +38,71 @@ typedef struct{
     VKBUFFER buffers[MAX_BUFFERS];
     BindingLimitations binding_read_write_limitations[MAX_BUFFERS];
     size_t buffer_count;
+    uint32_t local_size[3];
+    uint32_t local_size_ids[3]; //constant_id that sets each local_size, UINT32_MAX when fixed.
+    uint64_t shader_hash; //fnv1a of the SPIR-V, the program cache key.
+    uint32_t* spirv; //Kept so variants can be made without the file, see specializeProgram.
+    size_t spirv_size;
+    VKDISPATCH dispatch;
+    uint32_t push_constant_size;
+    uint8_t push_constants[MAX_PUSH_CONSTANT_SIZE];
 } VKPROGRAM;
 
+//Value of a specialization constant, matched by name when it is set and by constant_id otherwise.
+//value is the bit pattern: low 4 bytes for 32-bit types and bools, see specFloat for floats.
+typedef struct {
+    const char* name;
+    uint32_t id;
+    uint64_t value;
+} VKSPECIALIZATION;
+
+static inline uint64_t specFloat(float f) { uint32_t u; memcpy(&u, &f, sizeof(u)); return u; }
+
 typedef struct{
     char* entrypoint;
     uint32_t* spirv_bytecode;
     size_t spirv_bytecode_length;
+    VkSpecializationMapEntry* spec_entries; //Every constant of the module, defaults or overridden.
+    uint32_t spec_count;
+    uint8_t* spec_data;
+    size_t spec_size;
 } ShaderInfo;
 
+//SPIR-V compiled into the library by embed_shaders.sh, named after its file without ".spv".
+typedef struct {
+    const char* name;
+    const uint32_t* words;
+    size_t size; //In bytes.
+} VKEMBEDDEDSHADER;
+
+extern const VKEMBEDDEDSHADER swarm_embedded_shaders[];
+extern const uint32_t swarm_embedded_shader_count;
+
+//Falls back to the embedded shader of the same name when the file cannot be opened.
 VKPROGRAM createProgram(VKCTX ctx, const char* shader_path);
+//createProgram for each path, but the shaders are reflected in parallel and every pipeline is
+//created in one driver call. programs receives them in order.
+void createPrograms(VKCTX ctx, const char** shader_paths, uint32_t count, VKPROGRAM* programs);
+//size is in bytes. Identical SPIR-V shares one program however it was loaded.
+VKPROGRAM createProgramFromMemory(VKCTX ctx, const uint32_t* words, size_t size);
+//Without touching the filesystem, name is the file name without ".spv".
+VKPROGRAM createEmbeddedProgram(VKCTX ctx, const char* name);
+//A variant of the shader with the given constants, cached apart from other variants of the same
+//path. Constants that are not given keep the defaults compiled into the SPIR-V.
+VKPROGRAM createProgramSpecialized(VKCTX ctx, const char* shader_path, const VKSPECIALIZATION* constants, uint32_t constant_count);
+//Another variant of an existing program, from the SPIR-V it was made from.
+VKPROGRAM specializeProgram(VKCTX ctx, const VKPROGRAM* program, const VKSPECIALIZATION* constants, uint32_t constant_count);
+//Destroys every variant of the shader.
 void destroyProgram(VKCTX ctx, const char* shader_path);
+//specializeProgram that also tells whether this call built the variant rather than finding it cached.
+VKPROGRAM findOrCreateVariant(VKCTX ctx, const VKPROGRAM* program, const VKSPECIALIZATION* constants, uint32_t constant_count, bool* created);
+//Destroys one variant and its cached descriptor sets. No submission may still use them.
+void destroyVariant(VKCTX ctx, VKPROGRAM variant);
 void useBuffers(VKCTX ctx, VKPROGRAM* program, VKBUFFER* buffers, size_t buffer_count);
+VKDESCRIPTORSET* forgetDescriptorSets(BufferRange range, uint32_t* count);
 void verifyVKPROGRAM(VKPROGRAM* prog);
+void setDispatchDirect(VKPROGRAM* program, uint32_t x, uint32_t y, uint32_t z);
+void setDispatchIndirect(VKPROGRAM* program, VKBUFFER buffer, VkDeviceSize offset);
+void setDispatchElements(VKPROGRAM* program, uint32_t x, uint32_t y, uint32_t z);
+void setPushConstants(VKPROGRAM* program, const void* data, uint32_t offset, uint32_t size);
 #endif
\ No newline at end of file
@@ -1,4 +1,9 @@
 #include "vk_setup.h"
+#include "vk_profile.h"
+#include "vk_memory.h"
+#include "vk_command.h"
+#include "vk_cache.h"
+#include "vk_tune.h"
 
 VkInstance createInstance(const char** extensions, uint32_t extensionCount) {
     VkApplicationInfo appInfo = {
@@ -76,20 +81,67 @@ int32_t getQueueFamily(VkPhysicalDevice device, int32_t flags) {
     return result;
 }
 
-VkDevice createLogicalDevice(VkPhysicalDevice phys, uint32_t computeFamily, void* create_info_pnext, const char** extensions, uint32_t extensionCount) {
-    float priority = 1.0f;
+//Prefers a transfer-only family (usually a dedicated DMA engine), otherwise falls back to the compute family.
+uint32_t getTransferQueueFamily(VkPhysicalDevice device, uint32_t computeFamily) {
+    uint32_t qCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &qCount, NULL);
 
-    VkDeviceQueueCreateInfo queueInfo = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = computeFamily,
-        .queueCount = 1,
-        .pQueuePriorities = &priority,
+    VkQueueFamilyProperties *props = XMALLOC(sizeof(*props) * qCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &qCount, props);
+
+    uint32_t result = computeFamily;
+    for (uint32_t i = 0; i < qCount; i++) {
+        VkQueueFlags flags = props[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT))) {
+            result = i;
+            break;
+        }
+    }
+
+    free(props);
+    return result;
+}
+
+uint32_t getQueueCount(VkPhysicalDevice device, uint32_t family) {
+    uint32_t qCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &qCount, NULL);
+
+    VkQueueFamilyProperties *props = XMALLOC(sizeof(*props) * qCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &qCount, props);
+    uint32_t count = props[family].queueCount;
+    free(props);
+    return count;
+}
+
+//Creates one compute queue and one transfer queue. When both share a family a second queue is
+//requested from it if the family has one, otherwise the two end up being the same queue.
+VkDevice createLogicalDevice(VkPhysicalDevice phys, uint32_t computeFamily, uint32_t transferFamily, void* create_info_pnext, const char** extensions, uint32_t extensionCount) {
+    float priorities[2] = {1.0f, 1.0f};
+
+    VkDeviceQueueCreateInfo queueInfos[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = computeFamily,
+            .queueCount = 1,
+            .pQueuePriorities = priorities,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = transferFamily,
+            .queueCount = 1,
+            .pQueuePriorities = priorities,
+        },
     };
+    uint32_t queueInfoCount = 2;
+    if (transferFamily == computeFamily) {
+        queueInfos[0].queueCount = getQueueCount(phys, computeFamily) > 1 ? 2 : 1;
+        queueInfoCount = 1;
+    }
 
     VkDeviceCreateInfo deviceInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queueInfo,
+        .queueCreateInfoCount = queueInfoCount,
+        .pQueueCreateInfos = queueInfos,
         .pNext = create_info_pnext,
         .enabledExtensionCount = extensionCount,
         .ppEnabledExtensionNames = extensions,
@@ -100,30 +152,92 @@ VkDevice createLogicalDevice(VkPhysicalDevice phys, uint32_t computeFamily, void
     return device;
 }
 
-VkQueue getQueue(VkDevice device, int32_t queue_family_index){
+bool hasDeviceExtension(VkPhysicalDevice phys, const char* name){
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(phys, NULL, &count, NULL);
+    if (count == 0) return false;
+    VkExtensionProperties* exts = XMALLOC(sizeof(VkExtensionProperties) * count);
+    vkEnumerateDeviceExtensionProperties(phys, NULL, &count, exts);
+    bool found = false;
+    for (uint32_t i = 0; i < count && !found; ++i)
+        found = strcmp(exts[i].extensionName, name) == 0;
+    free(exts);
+    return found;
+}
+
+VkQueue getQueue(VkDevice device, int32_t queue_family_index, uint32_t queue_index){
     VkQueue q;
-    vkGetDeviceQueue(device, queue_family_index, 0, &q);
+    vkGetDeviceQueue(device, queue_family_index, queue_index, &q);
     return q;
 }
 
-VkDescriptorPool createDescriptorPool(VkDevice device){
+#define DESCRIPTOR_POOL_SETS 32
+
+//Each pool holds twice the sets of the one before it, with room for four buffers per set on average.
+VkDescriptorPool createDescriptorPool(VkDevice device, uint32_t max_sets){
     VkDescriptorPoolSize poolSize = {
         .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        .descriptorCount = 24
+        .descriptorCount = max_sets * 4
     };
 
     VkDescriptorPoolCreateInfo poolInfo = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .maxSets = 32,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, //growBuffer frees sets of replaced storage.
+        .maxSets = max_sets,
         .poolSizeCount = 1,
         .pPoolSizes = &poolSize
     };
 
     VkDescriptorPool pool;
-    vkCreateDescriptorPool(device, &poolInfo, NULL, &pool);
+    VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, NULL, &pool));
     return pool;
 }
 
+VKDESCRIPTORPOOLS* createDescriptorPools(VkDevice device){
+    VKDESCRIPTORPOOLS* p = XMALLOC(sizeof(VKDESCRIPTORPOOLS));
+    p->pools = XMALLOC(sizeof(VkDescriptorPool));
+    p->pools[0] = createDescriptorPool(device, DESCRIPTOR_POOL_SETS);
+    p->count = 1;
+    return p;
+}
+
+void destroyDescriptorPools(VkDevice device, VKDESCRIPTORPOOLS* p){
+    for (uint32_t i = 0; i < p->count; ++i) vkDestroyDescriptorPool(device, p->pools[i], NULL);
+    free(p->pools);
+    free(p);
+}
+
+//Tries the newest pool first, older ones may have room again after sets were freed.
+VKDESCRIPTORSET allocateDescriptorSet(VKCTX ctx, VkDescriptorSetLayout layout){
+    VKDESCRIPTORPOOLS* p = ctx.descriptor_pools;
+    VKDESCRIPTORSET d;
+    VkDescriptorSetAllocateInfo ai = {
+        .sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorSetCount = 1,
+        .pSetLayouts        = &layout
+    };
+    for (uint32_t i = p->count; i-- > 0; ) {
+        ai.descriptorPool = p->pools[i];
+        VkResult result = vkAllocateDescriptorSets(ctx.device, &ai, &d.set);
+        if (result == VK_SUCCESS) {
+            d.pool = p->pools[i];
+            return d;
+        }
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) VK_CHECK(result);
+    }
+
+    XREALLOC(p->pools, (p->count + 1) * sizeof(VkDescriptorPool));
+    p->pools[p->count] = createDescriptorPool(ctx.device, DESCRIPTOR_POOL_SETS << p->count);
+    d.pool = ai.descriptorPool = p->pools[p->count++];
+    VK_CHECK(vkAllocateDescriptorSets(ctx.device, &ai, &d.set));
+    return d;
+}
+
+void freeDescriptorSets(VKCTX ctx, const VKDESCRIPTORSET* sets, uint32_t count){
+    for (uint32_t i = 0; i < count; ++i)
+        VK_CHECK(vkFreeDescriptorSets(ctx.device, sets[i].pool, 1, &sets[i].set));
+}
+
 VkCommandPool createCommandPool(VkDevice device, uint32_t queueIndex){
     VkCommandPoolCreateInfo poolInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -136,22 +250,48 @@ VkCommandPool createCommandPool(VkDevice device, uint32_t queueIndex){
     return cmdPool;
 }
 
+VKTIMELINE* createTimeline(VkDevice device){
+    VkSemaphoreTypeCreateInfo typeInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    VkSemaphoreCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo,
+    };
+
+    VKTIMELINE* timeline = XMALLOC(sizeof(VKTIMELINE));
+    memset(timeline, 0, sizeof(VKTIMELINE));
+    VK_CHECK(vkCreateSemaphore(device, &info, NULL, &timeline->semaphore));
+    return timeline;
+}
+
+void destroyTimeline(VkDevice device, VKTIMELINE* timeline){
+    vkDestroySemaphore(device, timeline->semaphore, NULL);
+    free(timeline->pending);
+    free(timeline->buffers);
+    free(timeline->free_cmds);
+    free(timeline);
+}
+
 VKCTX createVkContext(){
     const char* instanceExts[] = {
         VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
         VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
     };
 
-    const char* deviceExts[] = {
+    const char* deviceExts[8] = {
         VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
         VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME, //atomic float
         //VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
         //VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
         //VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME,
         //VK_KHR_SPIRV_1_4_EXTENSION_NAME,
-        //VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
         //VK_KHR_MAINTENANCE_4_EXTENSION_NAME,
     };
+    uint32_t deviceExtCount = 2; //Optional extensions are appended once the device is picked.
 
     VkPhysicalDeviceShaderAtomicFloatFeaturesEXT atomic_float_featues = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_ATOMIC_FLOAT_FEATURES_EXT,
@@ -172,29 +312,61 @@ VKCTX createVkContext(){
     vk12.bufferDeviceAddress = VK_TRUE;
     vk12.descriptorIndexing = VK_TRUE;
     vk12.timelineSemaphore = VK_TRUE;
+    vk12.hostQueryReset = VK_TRUE;
 
     VKCTX ctx = {0};
     printf("Creating instance...\n");
     ctx.instance = createInstance(instanceExts, sizeof(instanceExts) / sizeof(char*));
     printf("Picking device...\n");
     ctx.physical_device = userPickDevice(ctx.instance);
+    bool memory_budget = hasDeviceExtension(ctx.physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memory_budget) deviceExts[deviceExtCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    bool host_import = hasDeviceExtension(ctx.physical_device, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    if (host_import) deviceExts[deviceExtCount++] = VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+    bool creation_feedback = hasDeviceExtension(ctx.physical_device, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    if (creation_feedback) deviceExts[deviceExtCount++] = VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME;
     printf("Selecting compute queue family...\n");
     ctx.queue_family_idx = getQueueFamily(ctx.physical_device, VK_QUEUE_COMPUTE_BIT);
+    printf("Selecting transfer queue family...\n");
+    ctx.transfer_queue_family_idx = getTransferQueueFamily(ctx.physical_device, ctx.queue_family_idx);
     printf("Creating logical device...\n");
-    ctx.device = createLogicalDevice(ctx.physical_device, ctx.queue_family_idx, &vk12, deviceExts, sizeof(deviceExts) / sizeof(char*));
-    printf("Picking queue...\n");
-    ctx.queue = getQueue(ctx.device, ctx.queue_family_idx);
+    ctx.device = createLogicalDevice(ctx.physical_device, ctx.queue_family_idx, ctx.transfer_queue_family_idx, &vk12, deviceExts, deviceExtCount);
+    printf("Picking queues...\n");
+    ctx.queue = getQueue(ctx.device, ctx.queue_family_idx, 0);
+    uint32_t transfer_queue_index = 0;
+    if (ctx.transfer_queue_family_idx == ctx.queue_family_idx && getQueueCount(ctx.physical_device, ctx.queue_family_idx) > 1)
+        transfer_queue_index = 1;
+    ctx.transfer_queue = getQueue(ctx.device, ctx.transfer_queue_family_idx, transfer_queue_index);
     printf("Creating descriptor pool...\n");
-    ctx.descriptor_pool = createDescriptorPool(ctx.device);
+    ctx.descriptor_pools = createDescriptorPools(ctx.device);
     printf("Creating command pool...\n");
     ctx.command_pool = createCommandPool(ctx.device, ctx.queue_family_idx);
+    ctx.transfer_command_pool = createCommandPool(ctx.device, ctx.transfer_queue_family_idx);
+    printf("Creating timeline semaphores...\n");
+    ctx.timeline = createTimeline(ctx.device);
+    ctx.transfer_timeline = createTimeline(ctx.device);
+    ctx.profiler = createProfiler(ctx.physical_device, ctx.queue_family_idx, ctx.transfer_queue_family_idx);
+    printf("Creating memory allocator...\n");
+    ctx.allocator = createAllocator(ctx.device, ctx.physical_device, ctx.queue_family_idx, ctx.transfer_queue_family_idx, memory_budget, host_import);
+    ctx.staging = createStaging(STAGING_RING_SIZE);
+    printf("Loading pipeline cache...\n");
+    ctx.pipeline_cache = createPipelineCache(ctx.device, ctx.physical_device, creation_feedback);
+    ctx.tuner = createTuner(ctx.physical_device);
     return ctx;
 }    
 
 void destroyVkContext(VKCTX s){
     vkDeviceWaitIdle(s.device);
-    vkDestroyDescriptorPool(s.device, s.descriptor_pool, NULL);
+    destroyStaging(s); //Its buffers retire through the timelines.
+    destroyTimeline(s.device, s.timeline);
+    destroyTimeline(s.device, s.transfer_timeline);
+    destroyProfiler(s.device, s.profiler);
+    destroyAllocator(s.device, s.allocator);
+    destroyPipelineCache(s.device, s.pipeline_cache);
+    destroyTuner(s.tuner);
+    destroyDescriptorPools(s.device, s.descriptor_pools);
     vkDestroyCommandPool(s.device, s.command_pool, NULL);
+    vkDestroyCommandPool(s.device, s.transfer_command_pool, NULL);
     vkDestroyDevice(s.device, NULL);
     vkDestroyInstance(s.instance, NULL);
 }
@@ -32,16 +32,87 @@ static inline void *xrealloc(void *p, size_t sz)
 #define XMALLOC(sz) xmalloc(sz)
 #define XREALLOC(pp, sz) ((pp) = xrealloc(pp, sz))
 
+//A command buffer waiting for the timeline to pass `value` before it can be freed.
+typedef struct {
+    VkCommandBuffer cmd;
+    uint64_t value;
+} PendingCommand;
+
+//Bytes of a buffer. Sub-allocated buffers share their VkBuffer with the rest of their block.
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} BufferRange;
+
+//A buffer range touched by a submission that signals `value`.
+typedef struct {
+    BufferRange range;
+    uint64_t value;
+} PendingBuffer;
+
+typedef struct {
+    VkSemaphore semaphore;
+    uint64_t value; //Value signalled by the most recent submission.
+    PendingCommand* pending;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    PendingBuffer* buffers; //Lets the other queue wait only on submissions that share a buffer with it.
+    uint32_t buffer_count;
+    uint32_t buffer_capacity;
+    VkCommandBuffer* free_cmds; //Retired command buffers, reset and ready for reuse.
+    uint32_t free_count;
+    uint32_t free_capacity;
+} VKTIMELINE;
+
+//Completion marker of an async submission, finished once the semaphore reaches value.
+typedef struct {
+    VkSemaphore semaphore;
+    uint64_t value;
+} VKTICKET;
+
+typedef struct VKPROFILER VKPROFILER;
+typedef struct VKALLOCATOR VKALLOCATOR;
+typedef struct VKBLOCK VKBLOCK;
+typedef struct VKSTAGING VKSTAGING;
+typedef struct VKPIPELINECACHE VKPIPELINECACHE;
+typedef struct VKTUNER VKTUNER;
+typedef struct VKDESCRIPTORPOOLS VKDESCRIPTORPOOLS;
+
+//A descriptor set and the pool it came from, which is the pool it must be freed to.
+typedef struct {
+    VkDescriptorSet set;
+    VkDescriptorPool pool;
+} VKDESCRIPTORSET;
+
+//Descriptor pools in creation order. A larger pool is added whenever none has room for a set.
+struct VKDESCRIPTORPOOLS {
+    VkDescriptorPool* pools;
+    uint32_t count;
+};
+
 typedef struct {
     VkInstance instance;
     VkPhysicalDevice physical_device;
     uint32_t queue_family_idx;
     VkDevice device;
     VkQueue queue;
-    VkDescriptorPool descriptor_pool;
+    VKDESCRIPTORPOOLS* descriptor_pools;
     VkCommandPool command_pool;
+    VKTIMELINE* timeline;
+    uint32_t transfer_queue_family_idx;
+    VkQueue transfer_queue;
+    VkCommandPool transfer_command_pool;
+    VKTIMELINE* transfer_timeline;
+    VKPROFILER* profiler;
+    VKALLOCATOR* allocator;
+    VKSTAGING* staging;
+    VKPIPELINECACHE* pipeline_cache;
+    VKTUNER* tuner;
 } VKCTX;
 
 VKCTX createVkContext();
 void destroyVkContext(VKCTX s);
+VKDESCRIPTORSET allocateDescriptorSet(VKCTX ctx, VkDescriptorSetLayout layout);
+void freeDescriptorSets(VKCTX ctx, const VKDESCRIPTORSET* sets, uint32_t count);
 #endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "vk_tune.h"
+#include "vk_cache.h"
+#include "vk_command.h"
+#include "vk_profile.h"
+#include <time.h>
+
+static void addEntry(VKTUNER* t, TuneEntry e){
+    for (uint32_t i = 0; i < t->entry_count; ++i) {
+        if (t->entries[i].shader_hash == e.shader_hash && !memcmp(t->entries[i].device_uuid, e.device_uuid, VK_UUID_SIZE)) {
+            t->entries[i] = e;
+            return;
+        }
+    }
+    if (t->entry_count == t->entry_capacity) {
+        t->entry_capacity = t->entry_capacity ? t->entry_capacity * 2 : 16;
+        XREALLOC(t->entries, t->entry_capacity * sizeof(TuneEntry));
+    }
+    t->entries[t->entry_count++] = e;
+}
+
+//One "device_uuid shader_hash constant_id local_size_x" line per entry, '#' starts a comment.
+static void loadEntries(VKTUNER* t){
+    FILE* f = fopen(t->path, "r");
+    if (!f) return;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char uuid[2 * VK_UUID_SIZE + 1];
+        unsigned long long hash;
+        TuneEntry e;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%32s %llx %u %u", uuid, &hash, &e.constant_id, &e.local_size) != 4 || strlen(uuid) != 2 * VK_UUID_SIZE) {
+            printf("Ignoring malformed line in %s: %s", t->path, line);
+            continue;
+        }
+        for (int i = 0; i < VK_UUID_SIZE; ++i) {
+            unsigned byte;
+            sscanf(uuid + 2 * i, "%2x", &byte);
+            e.device_uuid[i] = byte;
+        }
+        e.shader_hash = hash;
+        addEntry(t, e);
+    }
+    fclose(f);
+}
+
+static void saveEntries(VKTUNER* t){
+    if (!t->path) return;
+    const char* header = "# swarm workgroup tuning: device_uuid shader_hash constant_id local_size_x\n";
+    size_t cap = strlen(header) + (size_t)t->entry_count * 96 + 1;
+    char* text = XMALLOC(cap);
+    size_t n = sprintf(text, "%s", header);
+    for (uint32_t i = 0; i < t->entry_count; ++i) {
+        TuneEntry* e = &t->entries[i];
+        for (int b = 0; b < VK_UUID_SIZE; ++b) n += sprintf(text + n, "%02x", e->device_uuid[b]);
+        n += sprintf(text + n, " %016llx %u %u\n", (unsigned long long)e->shader_hash, e->constant_id, e->local_size);
+    }
+    swarmWriteFileAtomic(t->path, text, n, NULL, 0);
+    free(text);
+}
+
+VKTUNER* createTuner(VkPhysicalDevice phys){
+    VKTUNER* t = XMALLOC(sizeof(VKTUNER));
+    memset(t, 0, sizeof(VKTUNER));
+
+    VkPhysicalDeviceIDProperties id = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+    VkPhysicalDeviceProperties2 props = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &id };
+    vkGetPhysicalDeviceProperties2(phys, &props);
+    memcpy(t->device_uuid, id.deviceUUID, VK_UUID_SIZE);
+    t->max_size = props.properties.limits.maxComputeWorkGroupSize[0];
+    t->max_invocations = props.properties.limits.maxComputeWorkGroupInvocations;
+
+    const char* path = getenv("SWARM_TUNE_DB");
+    if (!path) path = TUNE_DEFAULT_PATH;
+    if (*path) {
+        t->path = XMALLOC(strlen(path) + 1);
+        strcpy(t->path, path);
+        loadEntries(t);
+    }
+    return t;
+}
+
+void destroyTuner(VKTUNER* t){
+    free(t->entries);
+    free(t->path);
+    free(t);
+}
+
+VKSPECIALIZATION* applyTuning(VKCTX ctx, uint64_t hash, const VKSPECIALIZATION* constants, uint32_t* constant_count){
+    VKTUNER* t = ctx.tuner;
+
+    for (uint32_t i = 0; i < t->entry_count; ++i) {
+        TuneEntry* e = &t->entries[i];
+        if (e->shader_hash != hash || memcmp(e->device_uuid, t->device_uuid, VK_UUID_SIZE)) continue;
+        VKSPECIALIZATION* all = XMALLOC((*constant_count + 1) * sizeof(VKSPECIALIZATION));
+        all[0] = (VKSPECIALIZATION){ NULL, e->constant_id, e->local_size };
+        memcpy(all + 1, constants, *constant_count * sizeof(VKSPECIALIZATION));
+        (*constant_count)++;
+        return all;
+    }
+    return (VKSPECIALIZATION*)constants;
+}
+
+//Device time of one dispatch, or host time around the submission when the queue has no timestamps.
+static uint64_t timeDispatch(VKCTX ctx, VKPROGRAM* program){
+    uint32_t before, count;
+    swarmGetProfile(ctx, &before);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    runComputeCommand(ctx, program, 1, (VKBUFFER){0});
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    const VKPROFILEEVENT* events = swarmGetProfile(ctx, &count);
+    for (uint32_t i = before; i < count; ++i)
+        if (events[i].queue == PROFILE_COMPUTE && !strcmp(events[i].name, program->shader_path))
+            return events[i].end_ns - events[i].start_ns;
+    return (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ull + (t1.tv_nsec - t0.tv_nsec);
+}
+
+static int compareTimes(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+uint32_t swarmTuneWorkgroupSize(VKCTX ctx, VKPROGRAM* program, uint32_t elements, const uint32_t* candidates, uint32_t candidate_count){
+    static const uint32_t defaults[] = { 32, 64, 128, 256, 512 };
+    if (!candidates) {
+        candidates = defaults;
+        candidate_count = sizeof(defaults) / sizeof(defaults[0]);
+    }
+    uint32_t id = program->local_size_ids[0];
+    if (id == UINT32_MAX) {
+        printf("%s has a fixed workgroup size, declare it with local_size_x_id to tune it\n", program->shader_path);
+        exit(EXIT_FAILURE);
+    }
+
+    //The caller's work is finished and its events resolved first, so every event from first_event
+    //on is a timing run and can be dropped afterwards without losing any of the caller's.
+    VKTUNER* t = ctx.tuner;
+    VKPROFILER* p = ctx.profiler;
+    bool profiling = p->enabled;
+    swarmWait(ctx, (VKTICKET){ ctx.timeline->semaphore, ctx.timeline->value });
+    swarmWait(ctx, (VKTICKET){ ctx.transfer_timeline->semaphore, ctx.transfer_timeline->value });
+    uint32_t first_event;
+    swarmGetProfile(ctx, &first_event);
+    swarmEnableProfiling(ctx, true);
+
+    VKPROGRAM best = *program;
+    bool best_created = false;
+    uint32_t best_size = 0;
+    uint64_t best_time = UINT64_MAX;
+    uint32_t other_dims = program->local_size[1] * program->local_size[2];
+    for (uint32_t c = 0; c < candidate_count; ++c) {
+        uint32_t size = candidates[c];
+        if (size == 0 || size > t->max_size || (uint64_t)size * other_dims > t->max_invocations) continue;
+
+        VKSPECIALIZATION spec = { NULL, id, size };
+        bool created;
+        VKPROGRAM variant = findOrCreateVariant(ctx, program, &spec, 1, &created);
+        useBuffers(ctx, &variant, program->buffers, program->buffer_count);
+        memcpy(variant.push_constants, program->push_constants, MAX_PUSH_CONSTANT_SIZE);
+        setDispatchElements(&variant, elements, 1, 1);
+
+        runComputeCommand(ctx, &variant, 1, (VKBUFFER){0}); //Warm-up, first runs pay for page faults and clocks.
+        uint64_t times[TUNE_RUNS];
+        for (int r = 0; r < TUNE_RUNS; ++r) times[r] = timeDispatch(ctx, &variant);
+        qsort(times, TUNE_RUNS, sizeof(uint64_t), compareTimes);
+        printf("%s: local_size_x %u takes %.3f ms\n", program->shader_path, size, times[TUNE_RUNS / 2] / 1e6);
+
+        //Variants built only for timing are destroyed once they lose, with their descriptor sets,
+        //so tuning does not hold on to pool space. Cached ones may be in use elsewhere and stay.
+        VKPROGRAM loser = variant;
+        bool loser_created = created;
+        if (times[TUNE_RUNS / 2] < best_time) {
+            best_time = times[TUNE_RUNS / 2];
+            best_size = size;
+            loser = best;
+            loser_created = best_created;
+            best = variant;
+            best_created = created;
+        }
+        if (loser_created) destroyVariant(ctx, loser); //runComputeCommand has waited for it.
+    }
+
+    profileResolve(ctx);
+    for (uint32_t i = first_event; i < p->event_count; ++i) free(p->events[i].name);
+    p->event_count = first_event;
+    swarmEnableProfiling(ctx, profiling);
+
+    if (best_size == 0) {
+        printf("%s: no candidate workgroup size fits the device limits\n", program->shader_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("%s: tuned to local_size_x %u\n", program->shader_path, best_size);
+    best.dispatch = program->dispatch;
+    *program = best;
+
+    TuneEntry e = { .shader_hash = program->shader_hash, .constant_id = id, .local_size = best_size };
+    memcpy(e.device_uuid, t->device_uuid, VK_UUID_SIZE);
+    addEntry(t, e);
+    saveEntries(t);
+    return best_size;
+}
@@ -0,0 +1,44 @@
+#ifndef VK_TUNE_H
+#define VK_TUNE_H
+
+#include "vk_setup.h"
+#include "vk_program.h"
+#include <stdbool.h>
+
+#define TUNE_DEFAULT_PATH "swarm_tuning.txt"
+#define TUNE_RUNS 5 //Timed dispatches per candidate, the median counts.
+
+//Fastest local_size_x found for one shader on one device.
+typedef struct {
+    uint8_t device_uuid[VK_UUID_SIZE];
+    uint64_t shader_hash; //fnv1a of the SPIR-V.
+    uint32_t constant_id; //Specialization constant that sets local_size_x.
+    uint32_t local_size;
+} TuneEntry;
+
+//Results of every device are kept, so one file can be shared by machines with different GPUs.
+struct VKTUNER {
+    char* path; //NULL when results are not persisted.
+    uint8_t device_uuid[VK_UUID_SIZE];
+    uint32_t max_size; //maxComputeWorkGroupSize[0].
+    uint32_t max_invocations;
+    TuneEntry* entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+};
+
+//Loaded from $SWARM_TUNE_DB, or TUNE_DEFAULT_PATH when unset. An empty string keeps results in memory.
+VKTUNER* createTuner(VkPhysicalDevice phys);
+void destroyTuner(VKTUNER* t);
+//The caller's constants with the tuned workgroup size in front, so an explicit value still wins.
+//Returns constants itself when the shader has not been tuned on this device, else a copy to free.
+VKSPECIALIZATION* applyTuning(VKCTX ctx, uint64_t shader_hash, const VKSPECIALIZATION* constants, uint32_t* constant_count);
+
+//Times program at each candidate local_size_x, with its bindings and push constants and one
+//invocation per element, then switches it to the fastest variant and remembers that size for this
+//device. The shader must size its workgroup with local_size_x_id, as the bundled shaders do with
+//layout(local_size_x = 64, local_size_x_id = 0) in; where local_size_x is the untuned default.
+//candidates may be NULL for 32, 64, 128, 256 and 512, sizes over the device limits are skipped.
+//Returns the chosen size.
+uint32_t swarmTuneWorkgroupSize(VKCTX ctx, VKPROGRAM* program, uint32_t elements, const uint32_t* candidates, uint32_t candidate_count);
+#endif
@@ -9,6 +9,9 @@
 #include <stdbool.h>
 
 #define MAX_BUFFERS 16
+#define PROFILE_COMPUTE 0
+#define PROFILE_TRANSFER 1
+#define MAX_PUSH_CONSTANT_SIZE 128 //Minimum maxPushConstantsSize every device supports.
 
 //Enums
 typedef enum {
@@ -20,28 +23,148 @@ typedef enum {
 typedef enum {
     BUF_CPU = 0,
     BUF_GPU = 1,
-    BUF_INDIRECT = 2
+    BUF_INDIRECT = 2,
+    BUF_SHARED = 3,
+    BUF_READBACK = 4,
+    BUF_UPLOAD = 5
 } BufferLocation;
 
 //Structs
+typedef struct {
+    VkCommandBuffer cmd;
+    uint64_t value;
+} PendingCommand;
+
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} BufferRange;
+
+typedef struct {
+    BufferRange range;
+    uint64_t value;
+} PendingBuffer;
+
+typedef struct {
+    VkSemaphore semaphore;
+    uint64_t value;
+    PendingCommand* pending;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    PendingBuffer* buffers;
+    uint32_t buffer_count;
+    uint32_t buffer_capacity;
+    VkCommandBuffer* free_cmds;
+    uint32_t free_count;
+    uint32_t free_capacity;
+} VKTIMELINE;
+
+typedef struct {
+    VkSemaphore semaphore;
+    uint64_t value;
+} VKTICKET;
+
+typedef struct VKPROFILER VKPROFILER;
+typedef struct VKALLOCATOR VKALLOCATOR;
+typedef struct VKBLOCK VKBLOCK;
+typedef struct VKPIPELINECACHE VKPIPELINECACHE;
+typedef struct VKTUNER VKTUNER;
+typedef struct VKSTAGING VKSTAGING;
+typedef struct VKDESCRIPTORPOOLS VKDESCRIPTORPOOLS;
+
 typedef struct {
     VkInstance instance;
     VkPhysicalDevice physical_device;
     uint32_t queue_family_idx;
     VkDevice device;
     VkQueue queue;
-    VkDescriptorPool descriptor_pool;
+    VKDESCRIPTORPOOLS* descriptor_pools;
     VkCommandPool command_pool;
+    VKTIMELINE* timeline;
+    uint32_t transfer_queue_family_idx;
+    VkQueue transfer_queue;
+    VkCommandPool transfer_command_pool;
+    VKTIMELINE* transfer_timeline;
+    VKPROFILER* profiler;
+    VKALLOCATOR* allocator;
+    VKSTAGING* staging;
+    VKPIPELINECACHE* pipeline_cache;
+    VKTUNER* tuner;
 } VKCTX;
 
+typedef struct VKGROWABLE VKGROWABLE;
+
 typedef struct VKBUFFER {
     VkBuffer       buffer;
     VkDeviceMemory memory;
     VkDeviceSize   size;
     BufferLocation location;
+    VkDeviceSize   offset;
+    VKBLOCK*       block;
+    void*          mapped;
+    VkMemoryPropertyFlags memory_flags;
+    bool           view;
+    VkDeviceSize   view_offset;
+    VKGROWABLE*    growable;
+    uint32_t       generation;
 } VKBUFFER;
 
+struct VKGROWABLE {
+    VKBUFFER storage;
+    VkDeviceSize size;
+    uint32_t generation;
+};
+
+static inline bool isStale(VKBUFFER b) { return b.growable && b.generation != b.growable->generation; }
+static inline VKBUFFER currentBuffer(VKBUFFER b) {
+    if (!b.growable) return b;
+    VKBUFFER cur = b.growable->storage;
+    cur.size = b.growable->size;
+    cur.growable = b.growable;
+    cur.generation = b.growable->generation;
+    if (!b.view) return cur;
+    cur.offset += b.view_offset;
+    if (cur.mapped) cur.mapped = (char*)cur.mapped + b.view_offset;
+    cur.size = b.size;
+    cur.view = true;
+    cur.view_offset = b.view_offset;
+    return cur;
+}
+
+typedef enum {
+    DISPATCH_DEFAULT = 0,
+    DISPATCH_DIRECT,
+    DISPATCH_INDIRECT,
+    DISPATCH_ELEMENTS
+} DispatchType;
+
+typedef struct {
+    const char* name;
+    const uint32_t* words;
+    size_t size;
+} VKEMBEDDEDSHADER;
+
+extern const VKEMBEDDEDSHADER swarm_embedded_shaders[];
+extern const uint32_t swarm_embedded_shader_count;
+
+typedef struct {
+    const char* name;
+    uint32_t id;
+    uint64_t value;
+} VKSPECIALIZATION;
+
+static inline uint64_t specFloat(float f) { uint32_t u; memcpy(&u, &f, sizeof(u)); return u; }
+
+typedef struct {
+    DispatchType type;
+    uint32_t x, y, z;
+    VKBUFFER buffer;
+    VkDeviceSize offset;
+} VKDISPATCH;
+
 typedef struct{
+    const char* shader_path;
     VkDescriptorSetLayout descriptor_set_layout;
     VkPipelineLayout pipeline_layout;
     VkPipeline pipeline;
@@ -51,8 +174,76 @@ typedef struct{
     VKBUFFER buffers[MAX_BUFFERS];
     BindingLimitations binding_read_write_limitations[MAX_BUFFERS];
     size_t buffer_count;
+    uint32_t local_size[3];
+    uint32_t local_size_ids[3];
+    uint64_t shader_hash;
+    uint32_t* spirv;
+    size_t spirv_size;
+    VKDISPATCH dispatch;
+    uint32_t push_constant_size;
+    uint8_t push_constants[MAX_PUSH_CONSTANT_SIZE];
 } VKPROGRAM;
 
+typedef struct {
+    VKBUFFER from;
+    VKBUFFER to;
+    VkDeviceSize from_offset;
+    VkDeviceSize to_offset;
+    VkDeviceSize size;
+} VKCOPY;
+
+typedef struct {
+    VkCommandBuffer cmd;
+    VKTICKET last;
+    BufferRange* buffers;
+    uint32_t buffer_count;
+} VKSEQUENCE;
+
+typedef struct {
+    VkCommandBuffer cmd;
+    VKTICKET ticket;
+    VkDeviceSize staging_offset;
+    VkDeviceSize staged;
+    VKCOPY* uploads;
+    uint32_t upload_count;
+    uint32_t upload_capacity;
+} VKFRAME;
+
+typedef struct {
+    VKFRAME* frames;
+    uint32_t frame_count;
+    uint32_t current;
+    VKBUFFER staging;
+    char* staging_mapped;
+    VkDeviceSize staging_size;
+} VKFRAMERING;
+
+typedef struct {
+    char* name;
+    uint32_t queue;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} VKPROFILEEVENT;
+
+typedef struct {
+    uint32_t block_count;
+    uint32_t allocation_count;
+    VkDeviceSize allocated;
+    VkDeviceSize used;
+    VkDeviceSize requested;
+    VkDeviceSize largest_free;
+    float fragmentation;
+} VKMEMORYSTATS;
+
+typedef struct {
+    VkDeviceSize size;
+    bool device_local;
+    VkDeviceSize budget;
+    VkDeviceSize usage;
+    VkDeviceSize allocated;
+    VkDeviceSize limit;
+} VKHEAPBUDGET;
+
 //vk_setup
 VKCTX createVkContext();
 void destroyVkContext(VKCTX s);
@@ -60,21 +251,68 @@ void destroyVkContext(VKCTX s);
 //vk_buffer
 VKBUFFER newBuffer(VKCTX ctx, VkDeviceSize size, BufferLocation where);
 void destroyBuffer(VKCTX ctx, VKBUFFER buf);
+VKBUFFER newBufferFromHostPointer(VKCTX ctx, void* ptr, VkDeviceSize size);
+bool swarmHasSharedMemory(VKCTX ctx);
+VKBUFFER newGrowableBuffer(VKCTX ctx, VkDeviceSize size, BufferLocation where);
+bool growBuffer(VKCTX ctx, VKBUFFER* buf, VkDeviceSize size);
+VKBUFFER bufferView(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize range);
+void swarmFlush(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize size);
+void swarmInvalidate(VKCTX ctx, VKBUFFER buf, VkDeviceSize offset, VkDeviceSize size);
 
-static inline void* mapBuffer(VKCTX ctx, VKBUFFER b) {
-    void* p; vkMapMemory(ctx.device, b.memory, 0, b.size, 0, &p); return p;
-}
-static inline void unmapBuffer(VKCTX ctx, VKBUFFER b) { 
-    vkUnmapMemory(ctx.device, b.memory); 
-}
+static inline void* mapBuffer(VKCTX ctx, VKBUFFER b) { return b.mapped; }
+static inline void unmapBuffer(VKCTX ctx, VKBUFFER b) { }
+
+//vk_memory
+VKMEMORYSTATS swarmMemoryStats(VKCTX ctx);
+uint32_t swarmGetMemoryBudget(VKCTX ctx, VKHEAPBUDGET heaps[VK_MAX_MEMORY_HEAPS]);
+void swarmSetMemoryLimit(VKCTX ctx, uint32_t heap, VkDeviceSize limit);
+
+//vk_cache
+bool swarmSavePipelineCache(VKCTX ctx);
+
+//vk_tune
+uint32_t swarmTuneWorkgroupSize(VKCTX ctx, VKPROGRAM* program, uint32_t elements, const uint32_t* candidates, uint32_t candidate_count);
 
 //vk_program
 VKPROGRAM createProgram(VKCTX ctx, const char* shader_path);
+VKPROGRAM createProgramSpecialized(VKCTX ctx, const char* shader_path, const VKSPECIALIZATION* constants, uint32_t constant_count);
+void createPrograms(VKCTX ctx, const char** shader_paths, uint32_t count, VKPROGRAM* programs);
+VKPROGRAM createProgramFromMemory(VKCTX ctx, const uint32_t* words, size_t size);
+VKPROGRAM createEmbeddedProgram(VKCTX ctx, const char* name);
+VKPROGRAM specializeProgram(VKCTX ctx, const VKPROGRAM* program, const VKSPECIALIZATION* constants, uint32_t constant_count);
 void destroyProgram(VKCTX ctx, const char* shader_path);
 void useBuffers(VKCTX ctx, VKPROGRAM* program, VKBUFFER* buffers, size_t buffer_count);
 void verifyVKPROGRAM(VKPROGRAM* prog);
+void setDispatchDirect(VKPROGRAM* program, uint32_t x, uint32_t y, uint32_t z);
+void setDispatchIndirect(VKPROGRAM* program, VKBUFFER buffer, VkDeviceSize offset);
+void setDispatchElements(VKPROGRAM* program, uint32_t x, uint32_t y, uint32_t z);
+void setPushConstants(VKPROGRAM* program, const void* data, uint32_t offset, uint32_t size);
 
 //vk_command
-void runCopyCommand(VKCTX ctx, VKBUFFER from, VKBUFFER to, uint32_t from_offset, uint32_t to_offset, uint32_t size);
+void runCopyCommand(VKCTX ctx, VKBUFFER from, VKBUFFER to, VkDeviceSize from_offset, VkDeviceSize to_offset, VkDeviceSize size);
 void runComputeCommand(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect);
+void runCopyListCommand(VKCTX ctx, const VKCOPY* copies, uint32_t copy_count);
+VKTICKET runCopyCommandAsync(VKCTX ctx, VKBUFFER from, VKBUFFER to, VkDeviceSize from_offset, VkDeviceSize to_offset, VkDeviceSize size);
+VKTICKET runComputeCommandAsync(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect);
+VKTICKET runCopyListCommandAsync(VKCTX ctx, const VKCOPY* copies, uint32_t copy_count);
+void swarmWait(VKCTX ctx, VKTICKET ticket);
+bool swarmPoll(VKCTX ctx, VKTICKET ticket);
+VKSEQUENCE createSequence(VKCTX ctx, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect);
+VKTICKET runSequenceAsync(VKCTX ctx, VKSEQUENCE* seq);
+void runSequence(VKCTX ctx, VKSEQUENCE* seq);
+void destroySequence(VKCTX ctx, VKSEQUENCE seq);
+VKFRAMERING createFrameRing(VKCTX ctx, uint32_t frame_count, VkDeviceSize staging_size);
+VKFRAME* beginFrame(VKCTX ctx, VKFRAMERING* ring);
+void frameUpload(VKFRAMERING* ring, VKFRAME* frame, VKBUFFER dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size);
+VKTICKET submitFrame(VKCTX ctx, VKFRAMERING* ring, VKPROGRAM* programs, uint32_t program_count, VKBUFFER indirect);
+void destroyFrameRing(VKCTX ctx, VKFRAMERING ring);
+void swarmUpload(VKCTX ctx, VKBUFFER dst, VkDeviceSize dst_offset, const void* src, VkDeviceSize size);
+void swarmDownload(VKCTX ctx, void* dst, VKBUFFER src, VkDeviceSize src_offset, VkDeviceSize size);
+VKTICKET swarmSubmitTransfers(VKCTX ctx);
+
+//vk_profile
+void swarmEnableProfiling(VKCTX ctx, bool enabled);
+const VKPROFILEEVENT* swarmGetProfile(VKCTX ctx, uint32_t* event_count);
+void swarmClearProfile(VKCTX ctx);
+void swarmWriteTrace(VKCTX ctx, const char* path);
 #endif
\ No newline at end of file